@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,47 +12,129 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To start reading a block that will be needed soon without
+//     waiting for it, call breadahead.
+// * To get a zeroed buffer for a newly allocated block without
+//     reading it, call bgetzero; to get a buffer for a block you
+//     will overwrite entirely, call bgetwhole.
+// * To ask whether a block is cached, call bcached; readers that
+//     bypass the cache must not bypass a cached, perhaps newer, copy.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed on (dev, blockno) into buckets, each with
+// its own lock, so lookups of different blocks do not contend.
+// A miss recycles a buffer chosen by a CLOCK sweep over all
+// buffers; misses are serialized by bcache.lock.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+extern char end[]; // first address after kernel loaded from ELF file
+
+#define BCACHEFRAC 64  // give the cache 1/BCACHEFRAC of physical memory
+#define NBUCKET  1021  // hash buckets
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // buffers hashed here, through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes buffer recycling
+  int nbuf;
+  struct bucket bucket[NBUCKET];
+  struct buf *hand;      // CLOCK hand, walks the clocknext ring
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBUCKET];
+}
+
+// Add b to the front of bucket h.
+// Caller must hold h->lock.
+static void
+bpush(struct bucket *h, struct buf *b)
+{
+  b->prev = 0;
+  b->next = h->head;
+  if(h->head)
+    h->head->prev = b;
+  h->head = b;
+}
+
+// Remove b from bucket h.
+// Caller must hold h->lock.
+static void
+bunlink(struct bucket *h, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    h->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Size the cache from the amount of physical memory and carve
+// the buffers out of whole pages. Each buffer's data gets a
+// page to itself, so a block never straddles a page boundary
+// (the DMA descriptors in ide.c rely on this). Must run after
+// kinit2.
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *last;
+  struct bucket *h;
+  char *page;
+  int i, n, per;
 
   initlock(&bcache.lock, "bcache");
 
+  bcache.nbuf = (PHYSTOP - V2P(end)) / BCACHEFRAC / (sizeof(struct buf) + PGSIZE);
+  if(bcache.nbuf < NBUF)
+    bcache.nbuf = NBUF;
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    initlock(&h->lock, "bcache.bucket");
+
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Create the ring of buffers; all start out in the bucket
+  // for block 0 of device 0, which the file system never reads.
+  per = PGSIZE / sizeof(struct buf);
+  last = 0;
+  h = bhash(0, 0);
+  for(i = 0; i < bcache.nbuf; i += n){
+    if((page = kalloc()) == 0)
+      panic("binit");
+    memset(page, 0, PGSIZE);
+    n = per;
+    if(n > bcache.nbuf - i)
+      n = bcache.nbuf - i;
+    for(b = (struct buf*)page; b < (struct buf*)page + n; b++){
+      initsleeplock(&b->lock, "buffer");
+      if((b->data = (uchar*)kalloc()) == 0)
+        panic("binit");
+      bpush(h, b);
+      if(last)
+        last->clocknext = b;
+      else
+        bcache.hand = b;
+      last = b;
+    }
   }
+  last->clocknext = bcache.hand;
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,33 +144,74 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *h, *bh;
+  int i;
 
-  acquire(&bcache.lock);
+  h = bhash(dev, blockno);
+  acquire(&h->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = h->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
+      release(&h->lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  release(&h->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  // Not cached. Only one process recycles at a time; it
+  // holds h->lock and takes one other bucket lock at a time,
+  // while everyone else holds at most one bucket lock.
+  acquire(&bcache.lock);
+  acquire(&h->lock);
+
+  // Did another process cache it while h was unlocked?
+  for(b = h->head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      release(&h->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+
+  // Recycle an unused buffer: sweep the clock hand, giving
+  // buffers used since the last sweep a second chance.
+  // log.c keeps blocks it has modified but not yet installed
+  // from being recycled by holding a reference (bpin).
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->clocknext;
+    if(b->refcnt != 0 || (b->flags & B_DIRTY))
+      continue;  // unlocked peek; rechecked below
+    if(b->used){
+      b->used = 0;
+      continue;
+    }
+    bh = bhash(b->dev, b->blockno);
+    if(bh != h)
+      acquire(&bh->lock);
+    if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+      if(bh != h)
+        release(&bh->lock);
+      continue;
+    }
+    bunlink(bh, b);
+    if(bh != h)
+      release(&bh->lock);
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    b->refcnt = 1;
+    bpush(h, b);
+    release(&h->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
   panic("bget: no buffers");
 }
 
@@ -105,6 +228,73 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block with its data
+// zeroed, without reading the block from disk: for blocks
+// just allocated, whose old contents do not matter.
+struct buf*
+bgetzero(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Return a locked buf for the indicated block, which the caller
+// is about to overwrite entirely, without reading it from disk.
+// Its data is valid if the block was cached, and garbage if not.
+struct buf*
+bgetwhole(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// The number of buffers in the cache.
+int
+bcachesize(void)
+{
+  return bcache.nbuf;
+}
+
+// Report whether the cache holds a buffer for the indicated
+// block, valid or on its way from the disk.
+int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *h;
+  struct buf *b;
+
+  h = bhash(dev, blockno);
+  acquire(&h->lock);
+  for(b = h->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&h->lock);
+  return b != 0;
+}
+
+// Start reading the indicated block into the cache, if it
+// is not there already, and return without waiting. The buffer
+// stays locked until the disk finishes; ideintr then calls bdone.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  iderwasync(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +305,40 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Drop a reference to an unlocked buffer.
+// Mark it recently used for the CLOCK sweep in bget.
+static void
+bput(struct buf *b)
+{
+  struct bucket *h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt--;
+  b->used = 1;
+  release(&h->lock);
+}
+
+// Keep b in the cache after its user releases it, by taking
+// an extra reference. Undone by bunpin.
+void
+bpin(struct buf *b)
+{
+  struct bucket *h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt++;
+  release(&h->lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  bput(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,20 +346,16 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Called by the disk driver when an asynchronous request
+// (iderwasync) finishes, on behalf of the process that started it.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
 }
 //PAGEBREAK!
 // Blank page.
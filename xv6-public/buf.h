@@ -4,11 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint used;        // referenced since the CLOCK hand last passed
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *clocknext; // ring of all buffers, for recycling
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qseq;         // submission order, for the disk queue deadline
+  uchar *data;       // BSIZE bytes in a page of their own
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // nobody waits for the read; ideintr calls bdone
 
@@ -10,6 +10,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "epoll.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -186,6 +187,8 @@ struct {
   uint e;  // Edit index
 } input;
 
+static struct pollq conspollq;  // epoll items waiting for a line
+
 #define C(x)  ((x)-'@')  // Control-x
 
 void
@@ -221,6 +224,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwake(&conspollq, EPOLLIN);
         }
       }
       break;
@@ -285,6 +289,21 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// For epoll: input is ready once a whole line has been typed,
+// as consoleread would return it; output always is.
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  r = EPOLLOUT;
+  acquire(&cons.lock);
+  if(input.r != input.w)
+    r |= EPOLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -292,6 +311,8 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
+  devsw[CONSOLE].pollq = &conspollq;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
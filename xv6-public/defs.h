@@ -1,8 +1,13 @@
 struct buf;
 struct context;
+struct epoll;
+struct epoll_event;
+struct iovec;
 struct file;
 struct inode;
+struct iostats;
 struct pipe;
+struct pollq;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -12,8 +17,16 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+void            bdone(struct buf*);
+int             bcached(uint, uint);
+int             bcachesize(void);
+struct buf*     bgetwhole(uint, uint);
+struct buf*     bgetzero(uint, uint);
+void            bpin(struct buf*);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
+void            bunpin(struct buf*);
 void            bwrite(struct buf*);
 
 // console.c
@@ -22,6 +35,15 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// epoll.c
+struct epoll*   epollalloc(void);
+void            epollclose(struct epoll*);
+int             epollctl(struct epoll*, int, int, struct file*, int);
+void            epolldrop(struct file*);
+void            epollinit(void);
+int             epollwait(struct epoll*, struct epoll_event*, int, int);
+void            pollwake(struct pollq*, int);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -31,10 +53,15 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int n);
 
 // fs.c
+uint            bmap(struct inode*, uint);
+void            dcenter(struct inode*, char*, uint);
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
@@ -43,6 +70,7 @@ struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+struct buf*     ireadblock(struct inode*, uint);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -57,6 +85,10 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwasync(struct buf*);
+void            idestats(struct iostats*);
+void            idesubmit(struct buf**, int);
+void            idewaitv(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,7 +97,9 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallochuge(void);
 void            kfree(char*);
+void            kfreehuge(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -83,9 +117,23 @@ void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
+void            log_data(struct buf*);
+void            log_free(uint);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            end_opn(int);
+int             logopmax(void);
+
+// mmap.c
+int             mmap(struct file*, uint, int, uint);
+int             mmapfault(struct proc*, uint);
+int             mmapin(struct proc*, uint, uint, int);
+void            mmapfork(struct proc*, struct proc*);
+void            mmapinit(void);
+int             munmap(uint, uint);
+void            munmapall(struct proc*);
 
 // mp.c
 extern int      ismp;
@@ -100,12 +148,19 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
+int             pipewritev(struct pipe*, struct iovec*, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
+int             pipepoll(struct pipe*, int);
+struct pollq*   pipepollq(struct pipe*);
 
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+pte_t           mmapsteal(struct proc*, uint, int);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -151,8 +206,10 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptrro(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
+int             fetchptr(uint, char**, int, int);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
@@ -175,6 +232,8 @@ void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+int             mappages(pde_t*, void*, uint, uint, int);
+pte_t*          walkpgdir(pde_t*, const void*, int);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
@@ -0,0 +1,316 @@
+// Readiness multiplexing: one process waits on many files.
+//
+// An epoll instance is a file (FD_EPOLL) holding a set of
+// watched files, each an epitem. Pipes and devices keep a
+// pollq of the items watching them and call pollwake() as
+// they become ready (pipewrite, piperead, pipeclose,
+// consoleintr); pollwake marks the items and wakes the
+// instance's waiters. epoll_wait then checks only the marked
+// items. Reporting is level-triggered: an item found ready
+// stays marked, to be checked again by the next wait.
+//
+// A watch does not keep its file open: when the last reference
+// to a file goes, fileclose calls epolldrop to remove the items
+// watching it, found through the file's epitems list, as in
+// Linux. epoll_wait takes a reference to a file while it asks
+// whether the file is ready.
+//
+// polllock protects every pollq and file's epitems list, the
+// items themselves, and each instance's seq. A pipe or device
+// calls pollwake holding its own lock, so polllock comes after
+// those, and one must not hold it while asking a file whether
+// it is ready. Each instance's sleeplock serializes epoll_ctl
+// and epoll_wait on it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "epoll.h"
+
+struct epitem {
+  struct epoll *ep;
+  struct file *f;        // watched file, referenced; 0 if unused
+  int fd;                // reported back to the caller
+  int events;            // EPOLLIN, EPOLLOUT wanted
+  int ready;             // may be ready; check in epoll_wait
+  struct pollq *q;       // the pollq it is on, or 0
+  struct epitem *qnext;
+  struct epitem *fnext;  // next on f->epitems
+};
+
+struct epoll {
+  struct sleeplock lock;
+  uint seq;              // pollwake calls so far
+  struct epitem item[NEPITEM];
+};
+
+static struct spinlock polllock;
+
+void
+epollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Mark the items on q waiting for any of events ready,
+// and wake their instances.
+void
+pollwake(struct pollq *q, int events)
+{
+  struct epitem *it;
+
+  acquire(&polllock);
+  for(it = q->head; it; it = it->qnext){
+    if(it->events & events || events & EPOLLHUP){
+      it->ready = 1;
+      it->ep->seq++;
+      wakeup(it->ep);
+    }
+  }
+  release(&polllock);
+}
+
+// The pollq a file notifies, or 0 for files that are always ready.
+static struct pollq*
+fileq(struct file *f)
+{
+  if(f->type == FD_PIPE)
+    return pipepollq(f->pipe);
+  if(f->type == FD_INODE && f->ip->type == T_DEV &&
+     f->ip->major >= 0 && f->ip->major < NDEV)
+    return devsw[f->ip->major].pollq;
+  return 0;
+}
+
+// Which of EPOLLIN, EPOLLOUT and EPOLLHUP hold for f now.
+static int
+fileready(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable);
+  if(f->type != FD_INODE)
+    return 0;
+  r = EPOLLIN|EPOLLOUT;
+  if(f->ip->type == T_DEV && f->ip->major >= 0 && f->ip->major < NDEV &&
+     devsw[f->ip->major].poll)
+    r = devsw[f->ip->major].poll(f->ip);
+  if(!f->readable)
+    r &= ~EPOLLIN;
+  if(!f->writable)
+    r &= ~EPOLLOUT;
+  return r;
+}
+
+struct epoll*
+epollalloc(void)
+{
+  struct epoll *ep;
+
+  if(sizeof(struct epoll) > PGSIZE)
+    panic("epollalloc");
+  if((ep = (struct epoll*)kalloc()) == 0)
+    return 0;
+  memset(ep, 0, sizeof(*ep));
+  initsleeplock(&ep->lock, "epoll");
+  return ep;
+}
+
+// Stop watching it->f. Caller holds polllock.
+static void
+itemfree(struct epitem *it)
+{
+  struct epitem **pp;
+
+  if(it->q){
+    for(pp = &it->q->head; *pp != it; pp = &(*pp)->qnext)
+      ;
+    *pp = it->qnext;
+  }
+  for(pp = &it->f->epitems; *pp != it; pp = &(*pp)->fnext)
+    ;
+  *pp = it->fnext;
+  memset(it, 0, sizeof(*it));
+}
+
+// Called by fileclose when the last reference to ep goes.
+void
+epollclose(struct epoll *ep)
+{
+  struct epitem *it;
+
+  acquiresleep(&ep->lock);
+  acquire(&polllock);
+  for(it = ep->item; it < ep->item + NEPITEM; it++)
+    if(it->f)
+      itemfree(it);
+  release(&polllock);
+  releasesleep(&ep->lock);
+  kfree((char*)ep);
+}
+
+// Called by fileclose before it drops the last reference to f:
+// f is closing, so stop every watch on it.
+void
+epolldrop(struct file *f)
+{
+  acquire(&polllock);
+  while(f->epitems)
+    itemfree(f->epitems);
+  release(&polllock);
+}
+
+// Add, change or remove the watch on file f, descriptor fd.
+// The watch lasts until it is removed, or ep or f is closed.
+// Returns 0, or -1.
+int
+epollctl(struct epoll *ep, int op, int fd, struct file *f, int events)
+{
+  struct epitem *it, *slot;
+  int r;
+
+  if(f->type == FD_EPOLL)
+    return -1;
+  r = -1;
+  acquiresleep(&ep->lock);
+  acquire(&polllock);
+  slot = 0;
+  for(it = ep->item; it < ep->item + NEPITEM; it++){
+    if(it->f == f && it->fd == fd)
+      break;
+    if(it->f == 0 && slot == 0)
+      slot = it;
+  }
+  if(it == ep->item + NEPITEM)
+    it = 0;
+
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(it || (it = slot) == 0)
+      break;
+    it->ep = ep;
+    it->f = f;
+    it->fd = fd;
+    it->events = events;
+    it->ready = 1;
+    if((it->q = fileq(f)) != 0){
+      it->qnext = it->q->head;
+      it->q->head = it;
+    }
+    it->fnext = f->epitems;
+    f->epitems = it;
+    r = 0;
+    break;
+  case EPOLL_CTL_MOD:
+    if(it == 0)
+      break;
+    it->events = events;
+    it->ready = 1;
+    r = 0;
+    break;
+  case EPOLL_CTL_DEL:
+    if(it == 0)
+      break;
+    itemfree(it);
+    r = 0;
+    break;
+  }
+  release(&polllock);
+  releasesleep(&ep->lock);
+  return r;
+}
+
+//PAGEBREAK!
+// Check the marked items of ep, filling evs with up to max
+// that are ready. Returns how many.
+// Caller holds ep->lock.
+static int
+epollscan(struct epoll *ep, struct epoll_event *evs, int max)
+{
+  struct epitem *it;
+  struct file *f;
+  int n, r, fd;
+
+  n = 0;
+  for(it = ep->item; it < ep->item + NEPITEM && n < max; it++){
+    acquire(&polllock);
+    f = 0;
+    if(it->f && it->ready){
+      // The file cannot close under fileready: fileclose
+      // drops f's items, under polllock, while f->ref is 1.
+      f = filedup(it->f);
+      fd = it->fd;
+      r = it->events | EPOLLHUP;
+    }
+    it->ready = 0;
+    release(&polllock);
+    if(f == 0)
+      continue;
+    r &= fileready(f);
+    fileclose(f);
+    if(r == 0)
+      continue;
+    evs[n].events = r;
+    evs[n].fd = fd;
+    n++;
+    acquire(&polllock);
+    if(it->f == f)
+      it->ready = 1;  // level-triggered: look again next time
+    release(&polllock);
+  }
+  return n;
+}
+
+// Wait until some watched file is ready, and fill evs with up
+// to max of them. timeout is in clock ticks: -1 waits for as
+// long as it takes, 0 not at all. A timed wait checks for
+// readiness at least once a tick. Returns how many are in evs,
+// or -1 if the caller was killed.
+int
+epollwait(struct epoll *ep, struct epoll_event *evs, int max, int timeout)
+{
+  uint seq, t0;
+  int n;
+
+  acquire(&tickslock);
+  t0 = ticks;
+  release(&tickslock);
+
+  acquiresleep(&ep->lock);
+  for(;;){
+    acquire(&polllock);
+    seq = ep->seq;
+    release(&polllock);
+    if((n = epollscan(ep, evs, max)) > 0 || timeout == 0)
+      break;
+    releasesleep(&ep->lock);
+
+    if(timeout < 0){
+      acquire(&polllock);
+      if(ep->seq == seq && !myproc()->killed)
+        sleep(ep, &polllock);
+      release(&polllock);
+    } else {
+      acquire(&tickslock);
+      if(ticks - t0 >= timeout){
+        release(&tickslock);
+        return 0;
+      }
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+    if(myproc()->killed)
+      return -1;
+    acquiresleep(&ep->lock);
+  }
+  releasesleep(&ep->lock);
+  return n;
+}
@@ -0,0 +1,16 @@
+// Readiness multiplexing, see epoll.c.
+
+// Events.
+#define EPOLLIN   0x001  // ready to read
+#define EPOLLOUT  0x004  // ready to write
+#define EPOLLHUP  0x010  // other end closed; always reported
+
+// epoll_ctl operations.
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+struct epoll_event {
+  int events;  // EPOLLIN, EPOLLOUT, EPOLLHUP
+  int fd;      // file descriptor given to EPOLL_CTL_ADD
+};
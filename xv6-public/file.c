@@ -5,10 +5,16 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "buf.h"
+#include "uio.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
@@ -61,6 +67,13 @@ fileclose(struct file *f)
   acquire(&ftable.lock);
   if(f->ref < 1)
     panic("fileclose");
+  if(f->ref == 1){
+    // Stop epoll watches while f is still open, so that
+    // epoll_wait may take a reference to it meanwhile.
+    release(&ftable.lock);
+    epolldrop(f);
+    acquire(&ftable.lock);
+  }
   if(--f->ref > 0){
     release(&ftable.lock);
     return;
@@ -72,6 +85,8 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
+  else if(ff.type == FD_EPOLL)
+    epollclose(ff.ep);
   else if(ff.type == FD_INODE){
     begin_op();
     iput(ff.ip);
@@ -92,66 +107,189 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Read from file f into the cnt segments of iov in order,
+// stopping where a read would come up short.
 int
-fileread(struct file *f, char *addr, int n)
+filereadv(struct file *f, struct iovec *iov, int cnt)
 {
-  int r;
+  struct iovec *v;
+  int n, r;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return pipereadv(f->pipe, iov, cnt);
   if(f->type == FD_INODE){
+    n = 0;
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    for(v = iov; v < iov + cnt; v++){
+      if((r = readi(f->ip, v->iov_base, f->off, v->iov_len)) < 0){
+        if(n == 0)
+          n = -1;
+        break;
+      }
       f->off += r;
+      n += r;
+      if(r != v->iov_len)
+        break;
+    }
     iunlock(f->ip);
-    return r;
+    return n;
   }
   panic("fileread");
 }
 
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1);
+}
+
 //PAGEBREAK!
-// Write to file f.
+// Write the cnt segments of iov to file f in order.
 int
-filewrite(struct file *f, char *addr, int n)
+filewritev(struct file *f, struct iovec *iov, int cnt)
 {
-  int r;
+  int r, n, tot;
+  uint done, m;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewritev(f->pipe, iov, cnt);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks at a time as one operation
+    // may reserve in the log, counting an extent or
+    // allocation block for each, the i-node, one more
+    // extent block, and 2 blocks of slop for non-aligned
+    // writes. the segments land next to each other in the
+    // file, so small ones share a single operation.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((logopmax()-1-1-2) / 2) * BSIZE;
     int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+    done = 0;
+    tot = 0;
+    r = 0;
+    while(i < cnt){
+      int n1 = 0;
+      for(n = i, m = done; n < cnt && n1 < max; n++, m = 0)
+        n1 += min(iov[n].iov_len - m, max - n1);
+      int nlog = ((n1 + BSIZE - 1) / BSIZE) * 2 + 1+1+2;
 
-      begin_op();
+      begin_opn(nlog);
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      for(n = 0; i < cnt && n < n1; n += r){
+        m = min(iov[i].iov_len - done, n1 - n);
+        if((r = writei(f->ip, (char*)iov[i].iov_base + done, f->off, m)) < 0)
+          break;
+        if(r != m)
+          panic("short filewrite");
         f->off += r;
+        if((done += r) == iov[i].iov_len){
+          i++;
+          done = 0;
+        }
+      }
       iunlock(f->ip);
-      end_op();
+      end_opn(nlog);
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+      tot += n;
+      while(i < cnt && iov[i].iov_len == 0)
+        i++;
     }
-    return i == n ? n : -1;
+    return r < 0 ? -1 : tot;
   }
   panic("filewrite");
 }
 
+// Write to file f.
+int
+filewrite(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1);
+}
+
+//PAGEBREAK!
+// Copy up to n bytes of the file in into pipe p straight from
+// the buffer cache, a block at a time. The inode is locked only
+// while the pipe has room, so the pipe's reader may use the file.
+static int
+splicepipe(struct file *in, struct pipe *p, int n)
+{
+  struct inode *ip = in->ip;
+  struct buf *bp;
+  int tot, m;
+
+  for(tot = 0; tot < n; tot += m){
+    if(pipewait(p) < 0)
+      return tot > 0 ? tot : -1;
+    ilock(ip);
+    if(in->off >= ip->size){
+      iunlock(ip);
+      break;
+    }
+    m = min(n - tot, BSIZE - in->off % BSIZE);
+    m = min(m, ip->size - in->off);
+    bp = ireadblock(ip, in->off / BSIZE);
+    m = pipeput(p, (char*)bp->data + in->off % BSIZE, m);
+    brelse(bp);
+    in->off += m;
+    iunlock(ip);
+  }
+  return tot;
+}
+
+// Move up to n bytes from file in to file out without copying
+// them through user space, stopping early where read would: at
+// the end of a file, once a pipe has given what it holds, or
+// once a device such as the console has given a line.
+// A file goes into a pipe straight from the buffer cache; other
+// pairs are copied through a kernel page.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *page;
+  int tot, r, m;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    ilock(in->ip);
+    r = in->ip->type != T_DEV;
+    iunlock(in->ip);
+    if(r)
+      return splicepipe(in, out->pipe, n);
+  }
+
+  if((page = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; ){
+    m = min(n - tot, PGSIZE);
+    if((r = fileread(in, page, m)) <= 0)
+      break;
+    if(filewrite(out, page, r) != r){
+      r = -1;
+      break;
+    }
+    tot += r;
+    if(in->type == FD_PIPE || r < m)
+      break;  // short, as read would be: no more for now
+  }
+  kfree(page);
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
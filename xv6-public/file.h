@@ -1,28 +1,44 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct epoll *ep;
+  struct epitem *epitems; // epoll items watching it, see epoll.c
   uint off;
 };
 
+// The epoll items watching a pipe or device, which it
+// notifies with pollwake() as it becomes ready. See epoll.c.
+struct pollq {
+  struct epitem *head;
+};
+
 
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *lprev; // icache LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint seqnext;       // block after the last one readi read
+  uint rahead;        // first block readahead has not requested
+  uint lblk;          // extent block bmap used last, or 0
+  uint lfirst;        // first file block described by lblk
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint indirect[NINDLEVEL];
 };
 
 // table mapping major device number to
@@ -30,6 +46,8 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*);  // EPOLLIN/EPOLLOUT if ready now
+  struct pollq *pollq;         // notified when it becomes ready
 };
 
 extern struct devsw devsw[];
@@ -20,9 +20,14 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "memlayout.h"
+
+extern char end[]; // first address after kernel loaded from ELF file
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(uint, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -38,45 +43,135 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Zero a block.
+// Zero a block, of file contents if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  bp = bgetzero(dev, bno);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// The allocator keeps a summary of the bitmap in memory, built
+// on first use: the number of free blocks in each group of
+// BGROUP blocks, and a cursor just past the last allocation.
+// Searches skip full groups, and full bytes within a group.
+// bsum.lock serializes allocation and freeing.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+#define BGROUP 1024  // blocks per group; divides BPB
+
+struct {
+  struct sleeplock lock;
+  int valid;
+  uint ngroup;
+  ushort *nfree;   // free blocks in each group
+  uint cursor;     // where the next search without a hint starts
+} bsum;
+
+// Count the free blocks of each group. Caller holds bsum.lock.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
-
-  bp = 0;
+  uint b, bi;
+
+  bsum.ngroup = (sb.size + BGROUP - 1) / BGROUP;
+  if(bsum.ngroup > PGSIZE / sizeof(ushort))
+    panic("bsuminit: too many groups");
+  if((bsum.nfree = (ushort*)kalloc()) == 0)
+    panic("bsuminit");
+  memset(bsum.nfree, 0, PGSIZE);
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[(b + bi) / BGROUP]++;
+    brelse(bp);
+  }
+  bsum.cursor = 0;
+  bsum.valid = 1;
+}
+
+// Return the first free block at or after b, wrapping around.
+// Caller holds bsum.lock.
+static uint
+bfind(uint dev, uint b)
+{
+  struct buf *bp;
+  uint g, i, end, bi;
+
+  g = b / BGROUP;
+  for(i = 0; i <= bsum.ngroup; i++){
+    if(bsum.nfree[g]){
+      end = min((g + 1) * BGROUP, sb.size);
+      bp = bread(dev, BBLOCK(b, sb));
+      while(b < end){
+        bi = b % BPB;
+        if(bi % 8 == 0 && b + 8 <= end && bp->data[bi/8] == 0xff){
+          b += 8;
+          continue;
+        }
+        if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+          brelse(bp);
+          return b;
+        }
+        b++;
       }
+      brelse(bp);
     }
-    brelse(bp);
+    g = (g + 1) % bsum.ngroup;
+    b = g * BGROUP;
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate up to n consecutive zeroed disk blocks, starting at
+// the first free block at or after near, so that a growing
+// file stays contiguous; near 0 means no preference. Sets *got
+// to the number allocated, at least 1. data says whether the
+// blocks will hold file contents, which skip the log.
+static uint
+balloc(uint dev, uint near, uint n, uint *got, int data)
+{
+  struct buf *bp;
+  uint b, bi, k;
+
+  acquiresleep(&bsum.lock);
+  if(!bsum.valid)
+    bsuminit(dev);
+  if(near == 0 || near >= sb.size)
+    near = bsum.cursor;
+  b = bfind(dev, near);
+
+  // Claim b and the free blocks after it in the same bitmap block.
+  bp = bread(dev, BBLOCK(b, sb));
+  for(k = 0; k < n && b + k < sb.size; k++){
+    bi = (b + k) % BPB;
+    if(k > 0 && bi == 0)
+      break;
+    if(bp->data[bi/8] & (1 << (bi % 8)))
+      break;
+    bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+    bsum.nfree[(b + k) / BGROUP]--;
+  }
+  log_write(bp);
+  brelse(bp);
+  bsum.cursor = b + k;
+  releasesleep(&bsum.lock);
+
+  for(bi = 0; bi < k; bi++)
+    bzero(dev, b + bi, data);
+  *got = k;
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -84,6 +179,7 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
+  acquiresleep(&bsum.lock);
   bp = bread(dev, BBLOCK(b, sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
@@ -91,7 +187,11 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  log_free(b);
   brelse(bp);
+  if(bsum.valid)
+    bsum.nfree[b / BGROUP]++;
+  releasesleep(&bsum.lock);
 }
 
 // Inodes.
@@ -110,6 +210,11 @@ bfree(int dev, uint b)
 // to inodes used by multiple processes. The cached
 // inodes include book-keeping information that is
 // not stored on disk: ip->ref and ip->valid.
+// The cache is sized at boot from the amount of physical
+// memory. Entries are hashed on (dev, inum), and entries
+// nobody references stay valid on an LRU list, so a file
+// opened again soon needs no disk read; iget recycles the
+// least recently used one.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
@@ -120,7 +225,7 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   may be recycled if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -130,7 +235,7 @@ bfree(int dev, uint b)
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -157,32 +262,98 @@ bfree(int dev, uint b)
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those
+// fields, or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define ICACHEFRAC 256  // give the cache up to 1/ICACHEFRAC of physical memory
+#define NIHASH 251      // hash buckets
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  int ninode;
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;  // unreferenced entries, least recently used first
+  struct inode *lrutail;
 } icache;
 
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
+// Add ip to the LRU list: at the tail, or at the head
+// to be recycled first. Caller must hold icache.lock.
+static void
+lruadd(struct inode *ip, int head)
+{
+  if(icache.lruhead == 0){
+    ip->lprev = ip->lnext = 0;
+    icache.lruhead = icache.lrutail = ip;
+  } else if(head){
+    ip->lprev = 0;
+    ip->lnext = icache.lruhead;
+    icache.lruhead->lprev = ip;
+    icache.lruhead = ip;
+  } else {
+    ip->lnext = 0;
+    ip->lprev = icache.lrutail;
+    icache.lrutail->lnext = ip;
+    icache.lrutail = ip;
+  }
+}
+
+// Remove ip from the LRU list. Caller must hold icache.lock.
+static void
+lrudel(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+}
+
+// Size the cache from physical memory, but no larger than the
+// number of inodes on dev, and carve it out of whole pages.
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  struct inode *ip;
+  char *page;
+  int i, n, per;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initsleeplock(&bsum.lock, "bsum");
+  dcinit();
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+
+  icache.ninode = (PHYSTOP - V2P(end)) / ICACHEFRAC / sizeof(struct inode);
+  if(icache.ninode > sb.ninodes)
+    icache.ninode = sb.ninodes;
+  if(icache.ninode < NINODE)
+    icache.ninode = NINODE;
+  per = PGSIZE / sizeof(struct inode);
+  for(i = 0; i < icache.ninode; i += n){
+    if((page = kalloc()) == 0)
+      panic("iinit");
+    memset(page, 0, PGSIZE);
+    n = per;
+    if(n > icache.ninode - i)
+      n = icache.ninode - i;
+    for(ip = (struct inode*)page; ip < (struct inode*)page + n; ip++){
+      initsleeplock(&ip->lock, "inode");
+      lruadd(ip, 0);
+    }
+  }
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -230,7 +401,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  memmove(dip->indirect, ip->indirect, sizeof(ip->indirect));
   log_write(bp);
   brelse(bp);
 }
@@ -241,31 +413,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  if((ip = icache.lruhead) == 0)
     panic("iget: no inodes");
+  lrudel(ip);
+  if(ip->inum){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   ip->ref = 1;
   ip->valid = 0;
+  ip->seqnext = 0;
+  ip->rahead = 0;
+  ip->lblk = 0;
   release(&icache.lock);
 
   return ip;
@@ -303,7 +483,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    memmove(ip->indirect, dip->indirect, sizeof(ip->indirect));
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -323,7 +504,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, though it stays valid until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -338,6 +519,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +530,8 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip, !ip->valid);  // keep valid inodes cached longest
   release(&icache.lock);
 }
 
@@ -363,42 +547,286 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, described by runs of consecutive
+// blocks. The first NEXTENT runs are in ip->ext[]; the rest
+// are in extent blocks, found through the trees rooted at
+// ip->indirect[0..NINDLEVEL-1] (see fs.h). A file only grows
+// at its end, and the new block extends the last run whenever
+// the disk block after it is free.
+//
+// Sequential access keeps using the same extent block, so
+// bmap remembers the last one in ip->lblk and tries it before
+// walking the trees from the top.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Return the disk block holding file block bn according to
+// the extent block blk, whose first extent starts at file
+// block first, or 0 if bn is past its last extent.
 static uint
-bmap(struct inode *ip, uint bn)
+leafmap(uint dev, uint blk, uint first, uint bn)
 {
-  uint addr, *a;
   struct buf *bp;
-
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
-  bn -= NDIRECT;
-
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  struct extent *a;
+  uint i, b;
+
+  bp = bread(dev, blk);
+  a = (struct extent*)bp->data;
+  b = 0;
+  bn -= first;
+  for(i = 0; i < NINDEXTENT && a[i].len; i++){
+    if(bn < a[i].len){
+      b = a[i].start + bn;
+      break;
     }
+    bn -= a[i].len;
+  }
+  brelse(bp);
+  return b;
+}
+
+// Walk down the index tree rooted at blk, level levels above
+// its extent blocks, to the extent block covering file block
+// bn, or the last one if bn is past them all. Sets *first to
+// that extent block's first file block.
+static uint
+idxwalk(uint dev, uint blk, int level, uint bn, uint *first)
+{
+  struct buf *bp;
+  struct extidx *x;
+  int i;
+
+  for(; level > 0; level--){
+    bp = bread(dev, blk);
+    x = (struct extidx*)bp->data;
+    for(i = 1; i < NINDEXIDX && x[i].block && x[i].fbn <= bn; i++)
+      ;
+    blk = x[i-1].block;
+    *first = x[i-1].fbn;
     brelse(bp);
-    return addr;
   }
+  return blk;
+}
+
+// Build a chain of level index blocks leading down to the
+// extent block leaf, whose first file block is bn.
+static uint
+idxchain(uint dev, int level, uint bn, uint leaf)
+{
+  struct buf *bp;
+  struct extidx *x;
+  uint b, got;
+
+  if(level == 0)
+    return leaf;
+  b = balloc(dev, 0, 1, &got, 0);
+  bp = bread(dev, b);
+  x = (struct extidx*)bp->data;
+  x[0].fbn = bn;
+  x[0].block = idxchain(dev, level-1, bn, leaf);
+  log_write(bp);
+  brelse(bp);
+  return b;
+}
 
+// Add the extent block leaf, whose first file block is bn, at
+// the right edge of the index tree rooted at blk, level levels
+// above its extent blocks. Returns 0 if the tree is full.
+static int
+idxadd(uint dev, uint blk, int level, uint bn, uint leaf)
+{
+  struct buf *bp;
+  struct extidx *x;
+  int i;
+
+  bp = bread(dev, blk);
+  x = (struct extidx*)bp->data;
+  for(i = 0; i < NINDEXIDX && x[i].block; i++)
+    ;
+  if(level > 1 && idxadd(dev, x[i-1].block, level-1, bn, leaf)){
+    brelse(bp);
+    return 1;
+  }
+  if(i == NINDEXIDX){
+    brelse(bp);
+    return 0;
+  }
+  x[i].fbn = bn;
+  x[i].block = idxchain(dev, level-1, bn, leaf);
+  log_write(bp);
+  brelse(bp);
+  return 1;
+}
+
+// Start a new extent block holding the run of len disk blocks
+// at b as file blocks bn.., and hook it into the first tree
+// with room.
+static void
+addleaf(struct inode *ip, uint b, uint len, uint bn)
+{
+  struct buf *bp;
+  struct extent *a;
+  uint leaf, got;
+  int level;
+
+  leaf = balloc(ip->dev, 0, 1, &got, 0);
+  bp = bread(ip->dev, leaf);
+  a = (struct extent*)bp->data;
+  a[0].start = b;
+  a[0].len = len;
+  log_write(bp);
+  brelse(bp);
+
+  if(ip->indirect[0] == 0){
+    ip->indirect[0] = leaf;
+    return;
+  }
+  for(level = 1; level < NINDLEVEL; level++){
+    if(ip->indirect[level] == 0){
+      ip->indirect[level] = idxchain(ip->dev, level, bn, leaf);
+      return;
+    }
+    if(idxadd(ip->dev, ip->indirect[level], level, bn, leaf))
+      return;
+  }
   panic("bmap: out of range");
 }
 
+// Allocate n blocks for file blocks bn.., where bn must be the
+// file's block count, and record them in ip's extents. Blocks
+// come in runs that continue the last extent where the disk
+// allows. Returns the block for bn.
+static uint
+bappend(struct inode *ip, uint bn, uint n)
+{
+  struct buf *bp;
+  struct extent *a, *last;
+  uint b, first, got, ret;
+  int i, slots, level;
+
+  ret = 0;
+  while(n > 0){
+    // Find the last extent, in the inode or the last extent block.
+    for(level = NINDLEVEL-1; level >= 0 && ip->indirect[level] == 0; level--)
+      ;
+    bp = 0;
+    if(level >= 0){
+      bp = bread(ip->dev, idxwalk(ip->dev, ip->indirect[level], level, bn, &first));
+      a = (struct extent*)bp->data;
+      slots = NINDEXTENT;
+    } else {
+      a = ip->ext;
+      slots = NEXTENT;
+    }
+    for(i = 0; i < slots && a[i].len; i++)
+      ;
+    last = i > 0 ? &a[i-1] : 0;
+
+    b = balloc(ip->dev, last ? last->start + last->len : 0, n, &got,
+               ip->type == T_FILE);
+    if(ret == 0)
+      ret = b;
+    if(last && b == last->start + last->len){
+      last->len += got;
+    } else if(i < slots){
+      a[i].start = b;
+      a[i].len = got;
+    } else {
+      if(bp)
+        brelse(bp);
+      addleaf(ip, b, got, bn);
+      bp = 0;
+    }
+    if(bp){
+      log_write(bp);
+      brelse(bp);
+    }
+    bn += got;
+    n -= got;
+  }
+  return ret;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If bn is just past the end of the file, bmap allocates it.
+// Caller must hold ip->lock.
+uint
+bmap(struct inode *ip, uint bn)
+{
+  uint i, b, blk, first, lfirst;
+  struct buf *bp;
+  int level;
+
+  if(ip->lblk && bn >= ip->lfirst &&
+     (b = leafmap(ip->dev, ip->lblk, ip->lfirst, bn)) != 0)
+    return b;
+
+  first = 0;
+  for(i = 0; i < NEXTENT && ip->ext[i].len; i++){
+    if(bn < first + ip->ext[i].len)
+      return ip->ext[i].start + bn - first;
+    first += ip->ext[i].len;
+  }
+
+  // Search the last tree that starts at or before bn.
+  for(level = NINDLEVEL-1; level >= 0; level--){
+    if(ip->indirect[level] == 0)
+      continue;
+    lfirst = first;
+    if(level > 0){
+      bp = bread(ip->dev, ip->indirect[level]);
+      lfirst = ((struct extidx*)bp->data)[0].fbn;
+      brelse(bp);
+    }
+    if(bn < lfirst)
+      continue;
+    blk = idxwalk(ip->dev, ip->indirect[level], level, bn, &lfirst);
+    if((b = leafmap(ip->dev, blk, lfirst, bn)) != 0){
+      ip->lblk = blk;
+      ip->lfirst = lfirst;
+      return b;
+    }
+    break;
+  }
+
+  // bn is past the last block of the file.
+  return bappend(ip, bn, 1);
+}
+
+// Free the blocks of run e and clear it.
+static void
+efree(uint dev, struct extent *e)
+{
+  uint i;
+
+  for(i = 0; i < e->len; i++)
+    bfree(dev, e->start + i);
+  e->start = 0;
+  e->len = 0;
+}
+
+// Free the tree rooted at blk, level levels above its
+// extent blocks, and every block it describes.
+static void
+treefree(uint dev, uint blk, int level)
+{
+  struct buf *bp;
+  struct extent *a;
+  struct extidx *x;
+  int i;
+
+  bp = bread(dev, blk);
+  if(level == 0){
+    a = (struct extent*)bp->data;
+    for(i = 0; i < NINDEXTENT; i++)
+      efree(dev, &a[i]);
+  } else {
+    x = (struct extidx*)bp->data;
+    for(i = 0; i < NINDEXIDX && x[i].block; i++)
+      treefree(dev, x[i].block, level-1);
+  }
+  brelse(bp);
+  bfree(dev, blk);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -407,28 +835,18 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  for(i = 0; i < NEXTENT; i++)
+    efree(ip->dev, &ip->ext[i]);
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NINDLEVEL; i++){
+    if(ip->indirect[i]){
+      treefree(ip->dev, ip->indirect[i], i);
+      ip->indirect[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->lblk = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -446,8 +864,128 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Note that readi has read block bn of ip. If the reads have
+// been sequential, keep the next NREADAHEAD blocks of the file
+// on their way from the disk while the caller uses this one.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, last;
+
+  if(bn != ip->seqnext && bn + 1 != ip->seqnext){
+    // Random access: start over.
+    ip->seqnext = bn + 1;
+    ip->rahead = bn + 1;
+    return;
+  }
+  ip->seqnext = bn + 1;
+  if(ip->rahead <= bn)
+    ip->rahead = bn + 1;
+
+  last = bn + NREADAHEAD;
+  if(last >= (ip->size + BSIZE - 1) / BSIZE)
+    last = (ip->size + BSIZE - 1) / BSIZE - 1;
+  for(b = ip->rahead; b <= last; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  if(ip->rahead <= last)
+    ip->rahead = last + 1;
+}
+
+// Return a locked buf holding block bn of ip's contents, which
+// must exist, and keep readahead going for a sequential reader.
+// Caller must hold ip->lock.
+struct buf*
+ireadblock(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+
+  bp = bread(ip->dev, bmap(ip, bn));
+  readahead(ip, bn);
+  return bp;
+}
+
+// If dst starts a page the kernel reaches through its direct
+// map (a user page of the current process, or kernel memory),
+// return the kernel address of that page, for the disk to read
+// a block straight into. Blocks are exactly one page. Else 0.
+static char*
+directpage(char *dst)
+{
+  struct proc *p;
+
+  if((uint)dst % PGSIZE != 0)
+    return 0;
+  if((uint)dst >= KERNBASE)
+    return (uint)dst < (uint)P2V(PHYSTOP) ? dst : 0;
+  p = myproc();
+  if(p == 0 || (uint)dst >= p->sz)
+    return 0;
+  return uva2ka(p->pgdir, dst);
+}
+
+// Read whole blocks of ip starting at off straight into the
+// pages at dst, sparing the copy out of the buffer cache, for
+// as long as dst is page-aligned and the blocks are not cached
+// (a cached copy may be newer than the disk). The disk gets up
+// to NDIRECTREAD blocks at once, in private bufs over the
+// caller's pages. Returns the number of bytes read, maybe 0.
+// Caller must hold ip->lock, which readi, writei and a file
+// mapping's page faults (mapin in mmap.c) all take before they
+// cache a block of ip. Pages that are mapped already are cached,
+// and so skipped. Should a block be cached during the read all
+// the same, it is copied from the cache afterwards, since that
+// copy is at least as new as the disk's.
+static uint
+readdirect(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct buf *bufs, *b, *bs[NDIRECTREAD];
+  char *page;
+  uint bn;
+  int i, nb;
+
+  if(BSIZE != PGSIZE || off % BSIZE != 0 || n < BSIZE)
+    return 0;
+  if(directpage(dst) == 0 || bcached(ip->dev, bmap(ip, off/BSIZE)))
+    return 0;
+  if((bufs = (struct buf*)kalloc()) == 0)
+    return 0;
+
+  for(nb = 0; nb < NDIRECTREAD && (nb+1)*BSIZE <= n; nb++){
+    bn = bmap(ip, off/BSIZE + nb);
+    if((page = directpage(dst + nb*BSIZE)) == 0 || bcached(ip->dev, bn))
+      break;
+    b = &bufs[nb];
+    memset(b, 0, sizeof(*b));
+    initsleeplock(&b->lock, "direct");
+    acquiresleep(&b->lock);
+    b->dev = ip->dev;
+    b->blockno = bn;
+    b->data = (uchar*)page;
+    bs[nb] = b;
+  }
+  idesubmit(bs, nb);
+  idewaitv(bs, nb);
+  for(i = 0; i < nb; i++){
+    releasesleep(&bs[i]->lock);
+    if(bcached(ip->dev, bs[i]->blockno)){
+      b = bread(ip->dev, bs[i]->blockno);
+      memmove(bs[i]->data, b->data, BSIZE);
+      brelse(b);
+    }
+  }
+  kfree((char*)bufs);
+
+  // Carry on as a sequential reader for readahead.
+  ip->seqnext = off/BSIZE + nb;
+  if(ip->rahead < ip->seqnext)
+    ip->rahead = ip->seqnext;
+  return nb*BSIZE;
+}
+
 //PAGEBREAK!
 // Read data from inode.
+// Whole blocks read into whole pages skip the buffer cache.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
@@ -467,7 +1005,9 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((m = readdirect(ip, dst, off, n - tot)) > 0)
+      continue;
+    bp = ireadblock(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -481,7 +1021,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, have, want;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -495,11 +1035,23 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // Allocate the blocks this write appends up front, in runs.
+  have = (ip->size + BSIZE - 1) / BSIZE;
+  want = (off + n + BSIZE - 1) / BSIZE;
+  if(want > have)
+    bappend(ip, have, want - have);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)
+      bp = bgetwhole(ip->dev, bmap(ip, off/BSIZE));  // no need to read it
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_data(bp);  // file contents skip the log
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -519,17 +1071,141 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// The name cache remembers the results of dirlookup: which
+// inode a name in a directory refers to, or that the name is
+// absent (inum 0). Entries are hashed on (dev, directory inum,
+// name). Callers hold the directory's lock while they look
+// names up and while they change the directory, and update the
+// cache as they change it (dirlink, sys_unlink), so entries
+// never go stale. Entries under a directory are dropped when
+// the directory is freed, before its inum can be reused.
+
+#define NDCHASH 127
+
+struct dentry {
+  uint dev;
+  uint dinum;           // directory the name is in
+  char name[DIRSIZ];
+  uint inum;            // inode the name refers to, or 0 if none
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *hash[NDCHASH];
+  int hand;             // next entry to recycle
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dchash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDCHASH];
+}
+
+// Find the entry for name in directory dinum.
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dchash(dev, dinum, name); d; d = d->next)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Unlink d from its hash chain.
+// Caller must hold dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dchash(d->dev, d->dinum, d->name); *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+// Record that name in directory dp refers to inode inum,
+// or to nothing if inum is 0. Caller must hold dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, **h;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    d = &dcache.entry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(d->dinum)
+      dcunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dchash(d->dev, d->dinum, d->name);
+    d->next = *h;
+    *h = d;
+  }
+  d->inum = inum;
+  release(&dcache.lock);
+}
+
+// Drop every entry for names in directory dinum.
+static void
+dcpurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry + NDENTRY; d++)
+    if(d->dinum == dinum && d->dev == dev)
+      dcunhash(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Lookups that do not need the offset try the name cache first.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(poff == 0){
+    acquire(&dcache.lock);
+    if((d = dcfind(dp->dev, dp->inum, name)) != 0){
+      inum = d->inum;
+      release(&dcache.lock);
+      return inum ? iget(dp->dev, inum) : 0;
+    }
+    release(&dcache.lock);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,10 +1216,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0);
   return 0;
 }
 
@@ -573,6 +1251,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum);
 
   return 0;
 }
@@ -3,7 +3,7 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -21,9 +21,32 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A file's blocks are described by a list of extents, each a run
+// of len consecutive disk blocks starting at start. The first
+// NEXTENT extents live in the inode. Later ones live in extent
+// blocks of NINDEXTENT each: indirect[0] names one extent block,
+// indirect[1] an index block whose entries name extent blocks,
+// and indirect[2] an index block of such index blocks. Unused
+// extents have len 0 and unused index entries block 0; both only
+// follow used ones.
+struct extent {
+  uint start;           // First disk block of the run
+  uint len;             // Number of blocks in the run
+};
+
+struct extidx {
+  uint fbn;             // First file block under this entry
+  uint block;           // Extent block, or index block one level down
+};
+
+#define NEXTENT 5
+#define NINDLEVEL 3
+#define NINDEXTENT (BSIZE / sizeof(struct extent))
+#define NINDEXIDX (BSIZE / sizeof(struct extidx))
+// Largest file, in blocks, that a uint offset can address. The
+// index tree holds this many extents, so it fits however
+// fragmented the file is.
+#define MAXFILE (0xFFFFFFFF / BSIZE)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +55,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT];  // Data block runs
+  uint indirect[NINDLEVEL];    // Trees of further extents
 };
 
 // Inodes per block.
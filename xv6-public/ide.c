@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code. Uses PCI bus-master DMA when the IDE
+// controller supports it (QEMU's PIIX does), PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +25,66 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// PCI configuration space access.
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// Bus-master IDE registers, relative to idebm.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+#define PRD_EOT       0x8000
+
+#define IDE_MULT      16   // sectors per interrupt in multiple mode
+#define IDE_MAXSECT   128  // most sectors merged into one command
+#define IDE_DEADLINE  64   // requests that may pass a waiting one
+
+// Requests wait on idequeue, linked through qnext and sorted
+// by (dev, blockno). idestart picks the next one in C-LOOK
+// order from the current head position, unless some request
+// has been passed over by IDE_DEADLINE newer ones, and merges
+// queued requests for the following blocks in the same
+// direction into a single multi-sector command.
+// ideactive is the chain of bufs that command is moving;
+// idecur, idecuroff and ideleft track the PIO transfer.
+// You must hold idelock while manipulating these.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static struct buf *idecur;
+static uint idecuroff;
+static uint ideleft;
+static uint idepos;     // key of the last block dispatched
+static uint ideseq;     // requests submitted so far
+static struct iostats idestat;
+
+// Physical region descriptor: one memory region of a DMA transfer.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+
+// The table must not cross a 64K boundary; at 1K and
+// 1K-aligned it cannot.
+static struct prd ideprd[IDE_MAXSECT] __attribute__((aligned(1024)));
+static ushort idebm;    // bus-master I/O base, or 0 to use PIO
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
+static void idecmd(int);
+
+// Sort key of a request: device, then block.
+#define IDEKEY(b) (((b)->dev << 24) | (b)->blockno)
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +99,60 @@ idewait(int checkerr)
   return 0;
 }
 
+static uint
+pciread(int dev, int func, int reg)
+{
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (dev<<11) | (func<<8) | reg);
+  return inl(PCI_CONFIG_DATA);
+}
+
+static void
+pciwrite(int dev, int func, int reg, uint v)
+{
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (dev<<11) | (func<<8) | reg);
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Look on PCI bus 0 for an IDE controller that can do
+// bus-master DMA, enable it, and return its bus-master
+// I/O base. Returns 0 if there is none.
+static ushort
+idepciinit(void)
+{
+  int dev, func;
+  uint class, bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      if((pciread(dev, func, 0x00) & 0xffff) == 0xffff)
+        continue;
+      class = pciread(dev, func, 0x08);
+      // Mass storage, IDE, bus-master capable.
+      if((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+        continue;
+      bar = pciread(dev, func, 0x20);
+      if((bar & 1) == 0)
+        continue;
+      // Enable I/O space and bus mastering.
+      pciwrite(dev, func, 0x04, pciread(dev, func, 0x04) | 0x5);
+      return bar & ~3;
+    }
+  }
+  return 0;
+}
+
+// Put the selected disk in multiple mode, IDE_MULT
+// sectors per interrupt, for RDMUL/WRMUL.
+static void
+idesetmult(int disk)
+{
+  outb(0x1f6, 0xe0 | (disk<<4));
+  idewait(0);
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
 void
 ideinit(void)
 {
@@ -65,37 +171,138 @@ ideinit(void)
     }
   }
 
+  // No interrupts for the setup commands.
+  outb(0x3f6, 2);
+  idesetmult(0);
+  if(havedisk1)
+    idesetmult(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idebm = idepciinit();
+  if(idebm)
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Move the next n sectors of the active command between
+// the disk and the bufs in the ideactive chain.
 static void
-idestart(struct buf *b)
+idepio(uint n, int write)
 {
-  if(b == 0)
-    panic("idestart");
-  if(b->blockno >= FSSIZE)
+  for(; n > 0; n--){
+    if(idecuroff == BSIZE){
+      idecur = idecur->qnext;
+      idecuroff = 0;
+    }
+    if(write)
+      outsl(0x1f0, idecur->data + idecuroff, SECTOR_SIZE/4);
+    else
+      insl(0x1f0, idecur->data + idecuroff, SECTOR_SIZE/4);
+    idecuroff += SECTOR_SIZE;
+  }
+}
+
+// Take the next run of requests off idequeue and start the
+// disk on it. Caller must hold idelock; the disk must be idle.
+static void
+idestart(void)
+{
+  struct buf *b, *last, **pp, **start, **oldest;
+  int sector_per_block, nsect, write;
+
+  if(ideactive || idequeue == 0)
+    return;
+
+  // Choose the first request: the one that has waited too
+  // long, else the next one at or past the head position.
+  oldest = &idequeue;
+  start = 0;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext){
+    if((*pp)->qseq < (*oldest)->qseq)
+      oldest = pp;
+    if(start == 0 && IDEKEY(*pp) >= idepos)
+      start = pp;
+  }
+  if(ideseq - (*oldest)->qseq > IDE_DEADLINE){
+    start = oldest;
+    idestat.ndeadline++;
+  } else if(start == 0)
+    start = &idequeue;
+
+  // Merge following requests for the next blocks.
+  sector_per_block = BSIZE/SECTOR_SIZE;
+  b = *start;
+  write = (b->flags & B_DIRTY) != 0;
+  nsect = sector_per_block;
+  for(last = b; last->qnext; last = last->qnext){
+    if(last->qnext->dev != b->dev ||
+       last->qnext->blockno != last->blockno + 1 ||
+       ((last->qnext->flags & B_DIRTY) != 0) != write ||
+       nsect + sector_per_block > IDE_MAXSECT)
+      break;
+    nsect += sector_per_block;
+    idestat.nmerged++;
+  }
+  *start = last->qnext;
+  last->qnext = 0;
+  idestat.depth -= nsect / sector_per_block;
+  idestat.ncmd++;
+  idepos = IDEKEY(last);
+
+  if(last->blockno >= FSSIZE)
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  ideactive = b;
+  idecmd(nsect);
+}
+
+// Issue the disk command for the nsect sectors of the
+// ideactive chain. Caller must hold idelock.
+static void
+idecmd(int nsect)
+{
+  struct buf *b, *p;
+  int sector, write, n, i;
+
+  b = ideactive;
+  write = (b->flags & B_DIRTY) != 0;
+  sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  idecur = b;
+  idecuroff = 0;
+  ideleft = nsect;
+
+  if(idebm){
+    // One descriptor per buf; a buf never crosses a page,
+    // so it never crosses a 64K boundary either.
+    for(i = 0, p = b; p; p = p->qnext, i++){
+      ideprd[i].addr = V2P(p->data);
+      ideprd[i].len = BSIZE;
+      ideprd[i].flags = p->qnext ? 0 : PRD_EOT;
+    }
+    outl(idebm + BM_PRDT, V2P(ideprd));
+    outb(idebm + BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ST_ERR|BM_ST_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect == 256 ? 0 : nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+    idestat.ndma++;
+  } else if(write){
+    outb(0x1f7, nsect == 1 ? IDE_CMD_WRITE : IDE_CMD_WRMUL);
+    n = ideleft < IDE_MULT ? ideleft : IDE_MULT;
+    idepio(n, 1);
+    ideleft -= n;
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, nsect == 1 ? IDE_CMD_READ : IDE_CMD_RDMUL);
   }
 }
 
@@ -103,39 +310,79 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  uint n;
+  uchar st;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(ideactive == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // The whole transfer is done; stop the engine.
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, st | BM_ST_ERR|BM_ST_INTR);
+    if(idewait(1) < 0 || (st & BM_ST_ERR)){
+      // Fall back to PIO for good and redo the command.
+      cprintf("ide: dma error, using pio\n");
+      idebm = 0;
+      idecmd(ideleft);
+      release(&idelock);
+      return;
+    }
+  } else if(ideactive->flags & B_DIRTY){
+    // Move the next block of sectors. The command is done once
+    // a read has brought in its last sector, or the disk has
+    // interrupted after a write's last sector.
+    n = ideleft < IDE_MULT ? ideleft : IDE_MULT;
+    if(ideleft > 0){
+      idepio(n, 1);
+      ideleft -= n;
+      release(&idelock);
+      return;
+    }
+  } else {
+    n = ideleft < IDE_MULT ? ideleft : IDE_MULT;
+    if(idewait(1) >= 0)
+      idepio(n, 0);
+    ideleft -= n;
+    if(ideleft > 0){
+      release(&idelock);
+      return;
+    }
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs, or finish
+  // requests that nobody waits for.
+  for(b = ideactive; b; b = next){
+    next = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    } else
+      wakeup(b);
+  }
+  ideactive = 0;
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next request in queue.
+  idestart();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Insert b into idequeue in (dev, blockno) order. The caller
+// starts the disk once it has queued everything it has, so
+// that adjacent requests can go out as one command.
+// Caller must hold idelock.
+static void
+idequeue1(struct buf *b)
 {
   struct buf **pp;
 
@@ -146,17 +393,68 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  b->qseq = ideseq++;
+  for(pp=&idequeue; *pp && IDEKEY(*pp) < IDEKEY(b); pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
 
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  idestat.nreq++;
+  if(++idestat.depth > idestat.maxdepth)
+    idestat.maxdepth = idestat.depth;
+}
+
+// Queue a read or write of b and return without waiting.
+// ideintr hands b to bdone when the request completes.
+void
+iderwasync(struct buf *b)
+{
+  acquire(&idelock);
+  b->flags |= B_ASYNC;
+  idequeue1(b);
+  idestart();
+  release(&idelock);
+}
+
+// Queue the n locked bufs in bs and return without waiting.
+// Adjacent blocks are merged into multi-block commands.
+// ideintr wakes each buf when its request completes; wait
+// for them with idewaitv.
+void
+idesubmit(struct buf **bs, int n)
+{
+  int i;
+
+  acquire(&idelock);
+  for(i = 0; i < n; i++)
+    idequeue1(bs[i]);
+  idestart();
+  release(&idelock);
+}
+
+// Wait for the n bufs in bs, queued by idesubmit, to finish.
+void
+idewaitv(struct buf **bs, int n)
+{
+  int i;
+
+  acquire(&idelock);
+  for(i = 0; i < n; i++)
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(bs[i], &idelock);
+  release(&idelock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);  //DOC:acquire-lock
+
+  idequeue1(b);
+  idestart();
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
@@ -166,3 +464,12 @@ iderw(struct buf *b)
 
   release(&idelock);
 }
+
+// Copy out the disk queue statistics.
+void
+idestats(struct iostats *st)
+{
+  acquire(&idelock);
+  *st = idestat;
+  release(&idelock);
+}
@@ -0,0 +1,20 @@
+#include "types.h"
+#include "iostat.h"
+#include "user.h"
+
+// Print the disk request queue statistics.
+int
+main(void)
+{
+  struct iostats st;
+
+  if(iostat(&st) < 0){
+    printf(2, "iostat: failed\n");
+    exit();
+  }
+  printf(1, "requests %d commands %d merged %d deadline %d\n",
+         st.nreq, st.ncmd, st.nmerged, st.ndeadline);
+  printf(1, "queue depth %d max %d\n", st.depth, st.maxdepth);
+  printf(1, "dma commands %d pio commands %d\n", st.ndma, st.ncmd - st.ndma);
+  exit();
+}
@@ -0,0 +1,10 @@
+// Disk request queue statistics, see idestats() in ide.c.
+struct iostats {
+  uint nreq;       // requests submitted
+  uint ncmd;       // disk commands issued
+  uint ndma;       // of which moved by bus-master DMA
+  uint nmerged;    // requests merged into a preceding one's command
+  uint ndeadline;  // commands started out of elevator order
+  uint depth;      // requests waiting now
+  uint maxdepth;   // most requests ever waiting at once
+};
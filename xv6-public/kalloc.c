@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, plus a small
+// reserve of 4Mbyte pages for large user heaps (see allocuvm).
 
 #include "types.h"
 #include "defs.h"
@@ -21,6 +22,7 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct run *hugelist;  // free 4Mbyte pages
 } kmem;
 
 // Initialization happens in two phases.
@@ -39,7 +41,15 @@ kinit1(void *vstart, void *vend)
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  char *p, *hstart;
+
+  // Set aside the top NHUGEPAGE 4Mbyte-aligned chunks of memory.
+  hstart = (char*)HUGEPGROUNDDOWN((uint)vend) - NHUGEPAGE*HUGEPGSIZE;
+  if(hstart < (char*)vstart)
+    hstart = (char*)vend;
+  freerange(vstart, hstart);
+  for(p = hstart; p + HUGEPGSIZE <= (char*)vend; p += HUGEPGSIZE)
+    kfreehuge(p);
   kmem.use_lock = 1;
 }
 
@@ -83,9 +93,20 @@ char*
 kalloc(void)
 {
   struct run *r;
+  char *p;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
+  if(kmem.freelist == 0 && kmem.hugelist){
+    // Out of small pages: break up a 4Mbyte page.
+    p = (char*)kmem.hugelist;
+    kmem.hugelist = kmem.hugelist->next;
+    for(r = (struct run*)(p + HUGEPGSIZE - PGSIZE); (char*)r >= p;
+        r = (struct run*)((char*)r - PGSIZE)){
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
+  }
   r = kmem.freelist;
   if(r)
     kmem.freelist = r->next;
@@ -94,3 +115,37 @@ kalloc(void)
   return (char*)r;
 }
 
+// Free a 4Mbyte page returned by kallochuge().
+void
+kfreehuge(char *v)
+{
+  struct run *r;
+
+  if((uint)v % HUGEPGSIZE || v < end || V2P(v) + HUGEPGSIZE > PHYSTOP)
+    panic("kfreehuge");
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = (struct run*)v;
+  r->next = kmem.hugelist;
+  kmem.hugelist = r;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Allocate one 4Mbyte-aligned 4Mbyte page of physical memory.
+// Returns 0 if none is left; callers fall back to kalloc().
+char*
+kallochuge(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = kmem.hugelist;
+  if(r)
+    kmem.hugelist = r->next;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return (char*)r;
+}
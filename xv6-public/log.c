@@ -1,6 +1,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -9,155 +10,324 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction only commits when there are no FS
+// system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// But if it thinks the transaction is close to full, it
+// sleeps until the transaction commits. Each call reserves
+// room for MAXOPBLOCKS blocks; an operation that writes more,
+// like a large write(), reserves what it needs with
+// begin_opn(n)/end_opn(n).
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// File contents are not logged. log_data() records a data
+// block in the running transaction instead, and commit()
+// writes it straight to its home location before the commit
+// point (ordered mode), so a committed inode never points at
+// data that did not reach the disk. A data block goes through
+// the log after all if the running transaction freed it, or an
+// uninstalled transaction in the ring holds it as metadata:
+// writing it home early could clobber a file whose deletion
+// has not committed, or be overwritten by installing the
+// stale metadata copy.
+//
+// Transactions are double-buffered: while one commits, the
+// next collects new system calls. commit() copies the closed
+// transaction's blocks aside, so new system calls may modify
+// the cached blocks again at once, and writes the copies to
+// the log as a batch the disk merges into a few commands. Data
+// blocks are not copied; commit() locks them for their writes
+// home before letting new system calls in, so the next
+// transaction cannot change one before it reaches the disk.
+//
+// The log is a circular, physical re-do log of disk blocks.
+// mkfs sets its size (sb.nlog). The on-disk log format:
+//   super block: ring slots of the oldest committed
+//     transaction not yet installed (tail) and of the
+//     first free slot (head)
+//   ring of slots, each transaction taking
+//     a descriptor, listing block #s for block A, B, ...
+//     block A
+//     block B
+//     ...
+// Writing a new head to the super block commits. Committed
+// transactions stay in the ring, pinned in the cache, until
+// the ring runs short of space; checkpoint() then installs
+// the oldest ones at their home locations together, writing
+// a block that later transactions also hold only once.
+
+// A descriptor block. Also the running transaction.
+#define LOGMAXTXN (BSIZE/sizeof(int) - 1)
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAXTXN];
+};
+
+// The log's super block.
+struct logsuper {
+  uint tail;
+  uint head;
 };
 
+#define MAXLOG 1024  // largest log initlog accepts, in slots
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // slots in the ring
+  int maxtxn;      // most blocks one transaction may hold
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks the outstanding ones may still log
+  int committing;  // in commit(); only one at a time.
+  int closing;     // commit() waits for outstanding ops; begin_op waits.
   int dev;
-  struct logheader lh;
+  uint tail;       // ring slot of oldest committed transaction
+  uint head;       // ring slot after newest committed transaction
+  struct logheader lh;   // running transaction
+  int nd;                // data blocks in the running transaction
+  int nfreed;            // runs of blocks it freed
+  int freedall;          // freed more runs than fit in freed[]
+  struct buf *sbuf;      // super block
 };
 struct log log;
 
+#define NFREED 64
+
+// The running transaction's data blocks, pinned, and the
+// blocks it freed; then the data blocks of the transaction
+// commit() is writing.
+static struct buf *dlist[LOGMAXTXN];
+static struct { uint start, len; } freed[NFREED];
+static struct buf *dwrite[LOGMAXTXN];
+
+// Private bufs, outside the buffer cache, for the ring: lbuf[i]
+// addresses slot i, and ibuf[i] the home of the block copied
+// into it, sharing lbuf[i]'s page. home[i] is the cached home
+// block, pinned until installed.
+static struct buf *lbuf[MAXLOG];
+static struct buf *ibuf[MAXLOG];
+static struct buf *home[MAXLOG];
+static struct buf *batch[MAXLOG];  // scratch for submit
+
+#define SLOT(i) ((i) % log.size)
+
 static void recover_from_log(void);
 static void commit();
 
+// Allocate a private buf for block blockno, sharing data.
+static struct buf*
+logbuf(uint blockno, uchar *data)
+{
+  static struct buf *next, *end;
+  struct buf *b;
+
+  if(next == end){
+    if((next = (struct buf*)kalloc()) == 0)
+      panic("logbuf");
+    end = next + PGSIZE/sizeof(struct buf);
+  }
+  b = next++;
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "logbuf");
+  b->dev = log.dev;
+  b->blockno = blockno;
+  b->data = data;
+  return b;
+}
+
+static uchar*
+logpage(void)
+{
+  uchar *page;
+
+  if((page = (uchar*)kalloc()) == 0)
+    panic("logpage");
+  return page;
+}
+
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  uchar *page;
+  int i;
+
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;
   log.dev = dev;
+  if(log.size > MAXLOG)
+    panic("initlog: log too big");
+  log.maxtxn = log.size/2 - 1;
+  if(log.maxtxn > LOGMAXTXN)
+    log.maxtxn = LOGMAXTXN;
+  if(logopmax() < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  for(i = 0; i < log.size; i++){
+    page = logpage();
+    lbuf[i] = logbuf(log.start+1+i, page);
+    ibuf[i] = logbuf(0, page);
+  }
+  log.sbuf = logbuf(log.start, logpage());
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Start writing the n private bufs in bs to disk.
 static void
-install_trans(void)
+submit(struct buf **bs, int n)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for(i = 0; i < n; i++){
+    acquiresleep(&bs[i]->lock);
+    bs[i]->flags = B_DIRTY;
   }
+  idesubmit(bs, n);
 }
 
-// Read the log header from disk into the in-memory log header
+// Wait for the writes started by submit(bs, n).
 static void
-read_head(void)
+await(struct buf **bs, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
-  brelse(buf);
+
+  idewaitv(bs, n);
+  for(i = 0; i < n; i++)
+    releasesleep(&bs[i]->lock);
+}
+
+// The descriptor of the transaction at ring slot pos.
+static struct logheader*
+desc(uint pos)
+{
+  return (struct logheader*)lbuf[pos]->data;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Number of free ring slots.
+static int
+logfree(void)
+{
+  return log.size - 1 - SLOT(log.head + log.size - log.tail);
+}
+
+// Write the in-memory tail and head to the log's super block.
+// Writing a new head is the true point at which a
+// transaction commits.
 static void
-write_head(void)
+write_super(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
-  bwrite(buf);
-  brelse(buf);
+  struct logsuper *ls = (struct logsuper *) (log.sbuf->data);
+
+  ls->tail = log.tail;
+  ls->head = log.head;
+  submit(&log.sbuf, 1);
+  await(&log.sbuf, 1);
 }
 
+// Install every committed transaction left in the log,
+// oldest first.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *sb, *hb, *lb, *db;
+  struct logsuper *ls;
+  struct logheader *lh;
+  uint pos;
+  int i, n;
+
+  sb = bread(log.dev, log.start);
+  ls = (struct logsuper *) (sb->data);
+  log.tail = ls->tail;
+  log.head = ls->head;
+  brelse(sb);
+  if(log.tail >= log.size || log.head >= log.size)
+    panic("recover_from_log");
+
+  for (pos = log.tail; pos != log.head; pos = SLOT(pos + 1 + n)) {
+    hb = bread(log.dev, log.start+1+pos); // read descriptor
+    lh = (struct logheader *) (hb->data);
+    n = lh->n;
+    for (i = 0; i < n; i++) {
+      lb = bread(log.dev, log.start+1+SLOT(pos+1+i)); // read log block
+      db = bread(log.dev, lh->block[i]); // read dst
+      memmove(db->data, lb->data, BSIZE);  // copy block to dst
+      bwrite(db);  // write dst to disk
+      brelse(lb);
+      brelse(db);
+    }
+    brelse(hb);
+  }
+  log.tail = log.head;
+  write_super(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Most blocks one operation may reserve with begin_opn: half
+// a transaction, so that two large writers can share one.
+int
+logopmax(void)
+{
+  return log.maxtxn / 2;
+}
+
+// called at the start of an FS operation that logs at most
+// n blocks, n <= logopmax().
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > logopmax())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.nd + log.reserved + n > log.maxtxn){
+      // this op might overfill the transaction; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of an operation begun by begin_opn(n).
+// commits if this was the last outstanding operation
+// and no commit is under way; otherwise the committer
+// picks up the transaction when it is done.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.outstanding == 0 && log.lh.n + log.nd > 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // the amount of reserved space; commit() may be
+    // waiting for the last op of a closing transaction.
     wakeup(&log);
   }
   release(&log.lock);
@@ -166,44 +336,241 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Does a committed transaction at or after ring slot pos
+// hold block b?
+static int
+later(int b, uint pos)
+{
+  struct logheader *d;
+  int i;
+
+  for(; pos != log.head; pos = SLOT(pos + 1 + d->n)){
+    d = desc(pos);
+    for(i = 0; i < d->n; i++)
+      if(d->block[i] == b)
+        return 1;
+  }
+  return 0;
+}
+
+// Install the oldest committed transactions until the ring
+// has need free slots. Only commit() calls this.
+static void
+checkpoint(int need)
+{
+  struct logheader *d;
+  uint pos, end;
+  int i, n;
+
+  if(logfree() >= need)
+    return;
+  end = log.tail;
+  while(log.size - 1 - SLOT(log.head + log.size - end) < need)
+    end = SLOT(end + 1 + desc(end)->n);
+
+  // Write each block from the newest transaction that holds it.
+  n = 0;
+  for(pos = log.tail; pos != end; pos = SLOT(pos + 1 + d->n)){
+    d = desc(pos);
+    for(i = 0; i < d->n; i++)
+      if(!later(d->block[i], SLOT(pos + 1 + d->n)))
+        batch[n++] = ibuf[SLOT(pos + 1 + i)];
+  }
+  submit(batch, n);
+  await(batch, n);
+
+  for(pos = log.tail; pos != end; pos = SLOT(pos + 1 + d->n)){
+    d = desc(pos);
+    for(i = 0; i < d->n; i++)
+      bunpin(home[SLOT(pos + 1 + i)]);  // may be evicted now
+  }
+  log.tail = end;
+  write_super();  // before the freed slots are reused
+}
+
+// Did the running transaction free block b?
+static int
+wasfreed(uint b)
+{
+  int i;
+
+  if(log.freedall)
+    return 1;
+  for(i = 0; i < log.nfreed; i++)
+    if(b >= freed[i].start && b < freed[i].start + freed[i].len)
+      return 1;
+  return 0;
+}
+
+// Does the running transaction log block b?
+static int
+logged(uint b)
+{
+  int i;
+
+  for(i = 0; i < log.lh.n; i++)
+    if(log.lh.block[i] == b)
+      return 1;
+  return 0;
+}
+
+// Sort the closed transaction's data blocks: into dwrite[] to
+// be written home before it commits, or into the transaction
+// itself when that is unsafe (see the top of this file).
+// Returns the number in dwrite[]. No FS system calls are
+// active. Caller holds log.lock.
+static int
+order(void)
+{
+  struct buf *b;
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < log.nd; i++){
+    b = dlist[i];
+    if(logged(b->blockno))
+      bunpin(b);  // the log has it already
+    else if(wasfreed(b->blockno) || later(b->blockno, log.tail))
+      log.lh.block[log.lh.n++] = b->blockno;  // keeps its pin
+    else
+      dwrite[n++] = b;
+  }
+  log.nd = 0;
+  log.nfreed = 0;
+  log.freedall = 0;
+  return n;
+}
+
+// Start writing the n cached data blocks in dwrite[] home.
+// Readers outside any op may be using them, so lock one at a
+// time: ideintr unlocks each when its write is done, and until
+// then no one can change it.
+static void
+write_data(int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    acquiresleep(&dwrite[i]->lock);
+    bpin(dwrite[i]);  // ideintr's bdone drops one reference
+    dwrite[i]->flags |= B_DIRTY;
+    iderwasync(dwrite[i]);
+  }
+}
+
+// Wait for the writes started by write_data(n), and unpin.
 static void
-write_log(void)
+await_data(int n)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for(i = 0; i < n; i++){
+    acquiresleep(&dwrite[i]->lock);
+    releasesleep(&dwrite[i]->lock);
+    bunpin(dwrite[i]);
   }
 }
 
+// Copy the running transaction into the ring at log.head: a
+// descriptor, then each block. No FS system calls are active,
+// so the cached blocks hold exactly the transaction's updates.
+static void
+snapshot(void)
+{
+  struct logheader *d;
+  struct buf *b;
+  uint s;
+  int i;
+
+  for (i = 0; i < log.lh.n; i++) {
+    s = SLOT(log.head + 1 + i);
+    b = bread(log.dev, log.lh.block[i]); // cached: log_write pinned it
+    memmove(lbuf[s]->data, b->data, BSIZE);
+    ibuf[s]->blockno = log.lh.block[i];
+    home[s] = b;
+    brelse(b);
+  }
+  d = desc(log.head);
+  d->n = log.lh.n;
+  memmove(d->block, log.lh.block, log.lh.n * sizeof(int));
+}
+
+// Write the descriptor and copies at log.head as one batch.
+static void
+write_log(int n)
+{
+  int i;
+
+  for (i = 0; i <= n; i++)
+    batch[i] = lbuf[SLOT(log.head + i)];
+  submit(batch, n+1);
+  await(batch, n+1);
+}
+
+// Commit the running transaction, and any that fill up and
+// go idle while this one commits. Caller has set committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  int n, nw;
+
+  acquire(&log.lock);
+  while(log.lh.n + log.nd > 0){
+    // Make room for the largest transaction. New ops may
+    // keep joining while old transactions install.
+    release(&log.lock);
+    checkpoint(1 + log.maxtxn);
+
+    acquire(&log.lock);
+    log.closing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    nw = order();
+    release(&log.lock);
+    snapshot();
+    // Start the data home, along with the log, before new ops
+    // may run: locking the bufs now keeps the next transaction
+    // from freeing, reusing and rewriting one of them before
+    // this one commits. No op is active to hold a buf's lock
+    // while it waits for the log.
+    write_data(nw);
+    acquire(&log.lock);
+    n = log.lh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    if(n > 0)
+      write_log(n);  // Write descriptor and copies to the log
+    await_data(nw);
+    if(n > 0){
+      log.head = SLOT(log.head + 1 + n);
+      write_super(); // Write head to disk -- the real commit
+    }
+
+    acquire(&log.lock);
+    if(log.outstanding > 0)
+      break;  // the last of them will commit
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// Record the block number and pin it in the cache.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +582,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n + log.nd >= log.maxtxn)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,9 +593,51 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {  // Add new block to log?
+    bpin(b);  // prevent eviction until installed
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  }
   release(&log.lock);
 }
 
+// Like log_write(), for a block of file contents: commit() will
+// write it home before the transaction commits, not to the log.
+void
+log_data(struct buf *b)
+{
+  int i;
+
+  if (log.lh.n + log.nd >= log.maxtxn)
+    panic("too big a transaction");
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  acquire(&log.lock);
+  for (i = 0; i < log.nd; i++) {
+    if (dlist[i] == b)   // absorption
+      break;
+  }
+  if (i == log.nd) {
+    bpin(b);  // keep it cached until written
+    dlist[log.nd++] = b;
+  }
+  release(&log.lock);
+}
+
+// Note that the running transaction frees block b, so that
+// commit() does not write new data over it before the
+// transaction commits.
+void
+log_free(uint b)
+{
+  acquire(&log.lock);
+  if (log.nfreed > 0 && freed[log.nfreed-1].start + freed[log.nfreed-1].len == b)
+    freed[log.nfreed-1].len++;
+  else if (log.nfreed < NFREED) {
+    freed[log.nfreed].start = b;
+    freed[log.nfreed].len = 1;
+    log.nfreed++;
+  } else
+    log.freedall = 1;
+  release(&log.lock);
+}
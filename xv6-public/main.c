@@ -28,11 +28,13 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  epollinit();     // readiness multiplexing
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from memory, after kinit2
+  mmapinit();      // file mappings, sized from the buffer cache
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -90,7 +90,6 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -158,7 +157,7 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off + BSIZE - 1)/BSIZE) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
 
@@ -252,6 +251,64 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of din, appending it
+// (fbn must then be the file's block count) from freeblock.
+// Mirrors bmap() in fs.c, but only as far as indirect[0]:
+// mkfs lays each file out contiguously, so it never needs
+// the deeper trees.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  struct extent ext[NINDEXTENT], *e, *last;
+  uint i, b;
+  int inind;
+
+  last = 0;
+  for(i = 0; i < NEXTENT && xint(din->ext[i].len); i++){
+    e = &din->ext[i];
+    if(fbn < xint(e->len))
+      return xint(e->start) + fbn;
+    fbn -= xint(e->len);
+    last = e;
+  }
+  inind = 0;
+  if(i == NEXTENT && xint(din->indirect[0])){
+    inind = 1;
+    rsect(xint(din->indirect[0]), (char*)ext);
+    for(i = 0; i < NINDEXTENT && xint(ext[i].len); i++){
+      e = &ext[i];
+      if(fbn < xint(e->len))
+        return xint(e->start) + fbn;
+      fbn -= xint(e->len);
+      last = e;
+    }
+  }
+
+  assert(fbn == 0);
+  if(last && freeblock == xint(last->start) + xint(last->len)){
+    b = freeblock++;
+    last->len = xint(xint(last->len) + 1);
+  } else if(!inind && i < NEXTENT){
+    b = freeblock++;
+    din->ext[i].start = xint(b);
+    din->ext[i].len = xint(1);
+  } else {
+    if(!inind){
+      inind = 1;
+      din->indirect[0] = xint(freeblock++);
+      bzero(ext, sizeof(ext));
+      i = 0;
+    }
+    assert(i < NINDEXTENT);
+    b = freeblock++;
+    ext[i].start = xint(b);
+    ext[i].len = xint(1);
+  }
+  if(inind)
+    wsect(xint(din->indirect[0]), (char*)ext);
+  return b;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +316,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -268,22 +324,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
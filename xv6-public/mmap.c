@@ -0,0 +1,420 @@
+// Memory-mapped files.
+//
+// mmap maps a file into a process's address space, above
+// MMAPBASE. Mappings are shared: a mapped page is the buffer
+// cache's own page for that file block, so every process that
+// maps the file, and read and write, see the same bytes. Since
+// a block is a page, the buffer cache serves as the page cache.
+//
+// Pages are mapped on first touch (mmapfault). A mapped page's
+// buf is pinned in the cache until the page is unmapped; then,
+// if the hardware has marked the page dirty, the block goes to
+// disk with the next transaction like any other write.
+//
+// At most 1/MAPFRAC of the buffer cache is mapped at once, so
+// that pinned pages leave room for everything else. Each mapped
+// page has an mpage; when none is free, a CLOCK hand sweeps the
+// mpages and unmaps a page its process has not used lately
+// (reclaim), preferring clean pages, which need no writing back.
+// The process faults the page back in if it touches it again.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define MAPFRAC   4  // map at most 1/MAPFRAC of the buffer cache
+#define NMPHASH 251  // hash buckets for mapped pages
+
+struct mpage {
+  struct proc *p;       // process mapping the page, or 0
+  uint va;              // where
+  struct buf *b;        // the page's buf, pinned
+  struct mpage *hnext;  // next in hash bucket, or on free list
+  struct mpage *cnext;  // next in the ring the CLOCK hand walks
+};
+
+struct {
+  struct spinlock lock;
+  int n;                         // mpages
+  struct mpage *free;
+  struct mpage *hand;            // CLOCK hand
+  struct mpage *hash[NMPHASH];   // mapped pages by process and va
+} mapped;
+
+// Carve the mpages out of kalloc()ed pages, one for each page
+// that may be mapped, and link them into the CLOCK ring.
+void
+mmapinit(void)
+{
+  struct mpage *m, *last;
+  char *page;
+  int i, per;
+
+  initlock(&mapped.lock, "mapped");
+  mapped.n = bcachesize() / MAPFRAC;
+  per = PGSIZE / sizeof(struct mpage);
+  page = 0;
+  last = 0;
+  for(i = 0; i < mapped.n; i++){
+    if(i % per == 0){
+      if((page = kalloc()) == 0)
+        panic("mmapinit");
+      memset(page, 0, PGSIZE);
+    }
+    m = (struct mpage*)page + i % per;
+    m->hnext = mapped.free;
+    mapped.free = m;
+    if(last)
+      last->cnext = m;
+    else
+      mapped.hand = m;
+    last = m;
+  }
+  last->cnext = mapped.hand;
+}
+
+static struct mpage**
+mphash(struct proc *p, uint va)
+{
+  return &mapped.hash[((uint)p / sizeof(*p) + va / PGSIZE) % NMPHASH];
+}
+
+// Remove m from its hash bucket and free it.
+// Caller must hold mapped.lock.
+static void
+mpfree(struct mpage *m)
+{
+  struct mpage **pp;
+
+  for(pp = mphash(m->p, m->va); *pp != m; pp = &(*pp)->hnext)
+    ;
+  *pp = m->hnext;
+  m->p = 0;
+  m->hnext = mapped.free;
+  mapped.free = m;
+}
+
+// Unmap a page that the CLOCK hand finds unused: clean if
+// possible, else dirty, then written back. Returns 0, or -1
+// if every mapped page is in use.
+static int
+reclaim(void)
+{
+  struct mpage *m;
+  struct buf *b;
+  pte_t pte;
+  int i;
+
+  pte = 0;
+  b = 0;
+  acquire(&mapped.lock);
+  // The first lap may only clear accessed bits, so take
+  // clean pages for two laps before dirty ones too.
+  for(i = 0; i < 3*mapped.n; i++){
+    m = mapped.hand;
+    mapped.hand = m->cnext;
+    if(m->p && (pte = mmapsteal(m->p, m->va, i >= 2*mapped.n)) != 0){
+      b = m->b;
+      mpfree(m);
+      break;
+    }
+  }
+  release(&mapped.lock);
+  if(pte == 0)
+    return -1;
+
+  if(pte & PTE_D){
+    begin_op();
+    b = bread(b->dev, b->blockno);  // cached: still pinned
+    log_data(b);
+    brelse(b);
+    end_op();
+  }
+  bunpin(b);
+  return 0;
+}
+
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NMMAP; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Map the page at va of p's mapping v, reading the block in
+// if it is not cached. Returns 0, or -1 if the page is past
+// the end of the file or no mapped page can be reclaimed.
+static int
+mapin(struct proc *p, struct vma *v, uint va)
+{
+  struct mpage *m;
+  struct buf *b;
+  uint off;
+  int perm;
+
+  acquire(&mapped.lock);
+  while((m = mapped.free) == 0){
+    release(&mapped.lock);
+    if(reclaim() < 0)
+      return -1;
+    acquire(&mapped.lock);
+  }
+  mapped.free = m->hnext;
+  release(&mapped.lock);
+
+  va = PGROUNDDOWN(va);
+  off = v->off + (va - v->addr);
+  ilock(v->ip);  // readdirect counts on this; see fs.c
+  if(off >= v->ip->size){
+    iunlock(v->ip);
+    goto bad;
+  }
+  b = bread(v->ip->dev, bmap(v->ip, off / BSIZE));
+  bpin(b);
+  brelse(b);
+  iunlock(v->ip);
+
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(b->data), perm) < 0){
+    bunpin(b);
+    goto bad;
+  }
+  acquire(&mapped.lock);
+  m->p = p;
+  m->va = va;
+  m->b = b;
+  m->hnext = *mphash(p, va);
+  *mphash(p, va) = m;
+  release(&mapped.lock);
+  return 0;
+
+bad:
+  acquire(&mapped.lock);
+  m->hnext = mapped.free;
+  mapped.free = m;
+  release(&mapped.lock);
+  return -1;
+}
+
+// Handle a page fault at va in p. Returns 0 if va lies in a
+// mapping and its page is now present, else -1.
+int
+mmapfault(struct proc *p, uint va)
+{
+  struct vma *v;
+  pte_t *pte;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P))
+    return -1;  // write to a read-only mapping
+  return mapin(p, v, va);
+}
+
+// Check that [va, va+n) lies within p's mappings, writable ones
+// if write is set, and map in its pages, so that a system call
+// can use it without faulting. The kernel's own stores ignore
+// PTE_W (CR0.WP is clear), hence the check. Returns 0, or -1.
+int
+mmapin(struct proc *p, uint va, uint n, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint a;
+
+  if(va + n < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    if((v = findvma(p, a)) == 0)
+      return -1;
+    if(write && !(v->prot & PROT_WRITE))
+      return -1;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((pte == 0 || (*pte & PTE_P) == 0) && mapin(p, v, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Unmap the n bytes at va, within mapping v of p: write back
+// pages the process has modified and unpin them all. Caller
+// is p, in a system call or exiting, so reclaim keeps off.
+static void
+unmap(struct proc *p, struct vma *v, uint va, uint n)
+{
+  struct mpage *m;
+  struct buf *b;
+  pte_t *pte;
+  uint a, end, off;
+  int i;
+
+  end = va + n;
+  a = va;
+  while(a < end){
+    // Each transaction writes at most MAXOPBLOCKS blocks.
+    begin_op();
+    ilock(v->ip);
+    for(i = 0; i < MAXOPBLOCKS && a < end; a += PGSIZE){
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & PTE_P) == 0)
+        continue;
+      off = v->off + (a - v->addr);
+      b = bread(v->ip->dev, bmap(v->ip, off / BSIZE));
+      if(PTE_ADDR(*pte) != V2P(b->data))
+        panic("unmap");
+      if(*pte & PTE_D){
+        log_data(b);
+        i++;
+      }
+      brelse(b);
+      bunpin(b);
+      *pte = 0;
+      acquire(&mapped.lock);
+      for(m = *mphash(p, a); m && (m->p != p || m->va != a); m = m->hnext)
+        ;
+      if(m == 0)
+        panic("unmap mpage");
+      mpfree(m);
+      release(&mapped.lock);
+    }
+    iunlock(v->ip);
+    end_op();
+  }
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));  // flush the TLB
+}
+
+// Unmap all of p's mappings, when it exits or execs.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  p->mmapbusy = 1;  // exit from trap() is not in a system call
+  for(v = p->vma; v < p->vma + NMMAP; v++){
+    if(v->len == 0)
+      continue;
+    unmap(p, v, v->addr, v->len);
+    begin_op();
+    iput(v->ip);
+    end_op();
+    memset(v, 0, sizeof(*v));
+  }
+}
+
+// Give child np the mappings of p. The child maps
+// the same pages in as it touches them.
+void
+mmapfork(struct proc *p, struct proc *np)
+{
+  int i;
+
+  for(i = 0; i < NMMAP; i++){
+    np->vma[i] = p->vma[i];
+    if(p->vma[i].len)
+      idup(p->vma[i].ip);
+  }
+}
+
+//PAGEBREAK!
+// Find room for a mapping of len bytes above MMAPBASE.
+static uint
+vmaplace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint a;
+
+  a = MMAPBASE;
+  for(v = p->vma; v < p->vma + NMMAP; ){
+    if(a + len > KERNBASE || a + len < a)
+      return 0;
+    if(v->len && a < v->addr + v->len && v->addr < a + len){
+      a = v->addr + v->len;
+      v = p->vma;  // start over
+    } else
+      v++;
+  }
+  return a;
+}
+
+// Map len bytes of f from offset off, which must be a multiple
+// of the block size, with protection prot. Returns the address
+// of the mapping, or -1.
+int
+mmap(struct file *f, uint len, int prot, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint a;
+
+  if(f->type != FD_INODE || len == 0 || off % BSIZE != 0)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE)) || !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  for(v = p->vma; v < p->vma + NMMAP; v++)
+    if(v->len == 0)
+      break;
+  if(v == p->vma + NMMAP)
+    return -1;
+  len = PGROUNDUP(len);
+  if((a = vmaplace(p, len)) == 0)
+    return -1;
+
+  v->addr = a;
+  v->len = len;
+  v->off = off;
+  v->prot = prot;
+  v->ip = idup(f->ip);
+  return a;
+}
+
+// Unmap the pages from addr for len bytes, which must be a
+// whole mapping or begin or end one. Returns 0, or -1.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = findvma(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;  // would split the mapping
+
+  unmap(p, v, addr, len);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    begin_op();
+    iput(v->ip);
+    end_op();
+    memset(v, 0, sizeof(*v));
+  }
+  return 0;
+}
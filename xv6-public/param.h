@@ -1,14 +1,22 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
+#define NPIDHASH   1024  // buckets in the pid hash table
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NMMAP         8  // file mappings per process
+#define PIPEPAGES     4  // pages of buffer per pipe, a power of two
+#define NEPITEM      64  // files one epoll instance may watch
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum size of the i-node cache
+#define NDENTRY     512  // entries in the directory name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       3000  // size of file system in blocks
+#define LOGSIZE      (FSSIZE/64)  // blocks in the on-disk log mkfs makes
+#define NBUF         (LOGSIZE*2)  // minimum size of disk block cache
+#define FSSIZE       16384  // size of file system in blocks
+#define NREADAHEAD      8  // blocks to read ahead of a sequential reader
+#define NDIRECTREAD    16  // most blocks read straight into the caller at once
+#define NHUGEPAGE       4  // 4MB pages set aside for large user heaps
 
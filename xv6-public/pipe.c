@@ -7,22 +7,53 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "epoll.h"
+#include "uio.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// The data is a ring of PIPEPAGES pages, which pipewrite and
+// piperead fill and drain with memmove, a page-sized run at a
+// time. PIPESIZE is a power of two, so nread and nwrite may
+// wrap around.
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollq pollq;  // epoll items watching either end
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->data[i])
+      kfree(p->data[i]);
+  kfree((char*)p);
+}
+
+// The bytes of the ring from offset off that lie in one page,
+// and where they start.
+static char*
+piperun(struct pipe *p, uint off, uint *m)
+{
+  off %= PIPESIZE;
+  *m = PGSIZE - off % PGSIZE;
+  return p->data[off / PGSIZE] + off % PGSIZE;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,6 +61,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->data[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +83,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -67,40 +102,145 @@ pipeclose(struct pipe *p, int writable)
     p->readopen = 0;
     wakeup(&p->nwrite);
   }
+  pollwake(&p->pollq, EPOLLHUP);
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Copy as much of the n bytes at addr into p as fits now.
+// Readers sleep only while the pipe is empty, so only a write
+// into an empty pipe needs to wake them. Returns the number
+// of bytes copied. Caller must hold p->lock.
+static uint
+pipecopyin(struct pipe *p, char *addr, uint n)
+{
+  uint i, m;
+  char *dst;
+
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; ){
+    dst = piperun(p, p->nwrite, &m);
+    m = min(m, min(p->nread + PIPESIZE - p->nwrite, n - i));
+    memmove(dst, addr + i, m);
+    if(p->nwrite == p->nread){
+      wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+      pollwake(&p->pollq, EPOLLIN);
+    }
+    p->nwrite += m;
+    i += m;
+  }
+  return i;
+}
+
+// Wait until p has room. Caller must hold p->lock.
+// Returns -1 if there are no readers, or the caller was killed.
+static int
+pipewaitroom(struct pipe *p)
+{
+  while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+    if(p->readopen == 0 || myproc()->killed)
+      return -1;
+    sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  }
+  return 0;
+}
+
+// Write all cnt segments of iov, in one acquisition of the
+// lock, so that they go in together unless the pipe fills.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewritev(struct pipe *p, struct iovec *iov, int cnt)
 {
-  int i;
+  struct iovec *v;
+  uint i;
+  int n;
 
+  n = 0;
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
+  for(v = iov; v < iov + cnt; v++){
+    for(i = 0; i < v->iov_len; ){
+      if(pipewaitroom(p) < 0){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      i += pipecopyin(p, (char*)v->iov_base + i, v->iov_len - i);
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    n += i;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
 int
-piperead(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return pipewritev(p, &iov, 1);
+}
+
+// For splice: wait until p has room, without holding any
+// other lock. Returns -1 if there are no readers.
+int
+pipewait(struct pipe *p)
+{
+  int r;
+
+  acquire(&p->lock);
+  r = pipewaitroom(p);
+  release(&p->lock);
+  return r;
+}
+
+// For splice: copy as much of the n bytes of kernel memory at
+// addr into p as fits, without waiting. Returns the number of
+// bytes copied.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int m;
+
+  acquire(&p->lock);
+  m = pipecopyin(p, addr, n);
+  release(&p->lock);
+  return m;
+}
+
+// Copy out what is there, up to n bytes. Writers sleep only
+// while the pipe is full, so only a read from a full pipe needs
+// to wake them. Returns the number of bytes copied.
+// Caller must hold p->lock.
+static uint
+pipecopyout(struct pipe *p, char *addr, uint n)
+{
+  uint i, m;
+  char *src;
+
+  for(i = 0; i < n && p->nread != p->nwrite; ){  //DOC: piperead-copy
+    src = piperun(p, p->nread, &m);
+    m = min(m, min(p->nwrite - p->nread, n - i));
+    memmove(addr + i, src, m);
+    if(p->nwrite == p->nread + PIPESIZE){
+      wakeup(&p->nwrite);  //DOC: piperead-wakeup
+      pollwake(&p->pollq, EPOLLOUT);
+    }
+    p->nread += m;
+    i += m;
+  }
+  return i;
+}
+
+// Wait for data, then fill the cnt segments of iov in order
+// with what is there, in one acquisition of the lock.
+int
+pipereadv(struct pipe *p, struct iovec *iov, int cnt)
+{
+  struct iovec *v;
+  int n;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +250,49 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  n = 0;
+  for(v = iov; v < iov + cnt && p->nread != p->nwrite; v++)
+    n += pipecopyout(p, v->iov_base, v->iov_len);
+  release(&p->lock);
+  return n;
+}
+
+int
+piperead(struct pipe *p, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return pipereadv(p, &iov, 1);
+}
+
+// For epoll: which of EPOLLIN, EPOLLOUT and EPOLLHUP hold
+// now for the read end of p, or the write end if writable.
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(p->readopen == 0)
+      r = EPOLLOUT|EPOLLHUP;
+    else if(p->nwrite != p->nread + PIPESIZE)
+      r = EPOLLOUT;
+  } else {
+    if(p->writeopen == 0)
+      r = EPOLLIN|EPOLLHUP;
+    else if(p->nread != p->nwrite)
+      r = EPOLLIN;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return r;
+}
+
+struct pollq*
+pipepollq(struct pipe *p)
+{
+  return &p->pollq;
 }
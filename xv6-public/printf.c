@@ -2,14 +2,31 @@
 #include "stat.h"
 #include "user.h"
 
+// Formatted output goes into buf: for snprintf the caller's
+// string, for printf a chunk handed to bufwrite as it fills,
+// so that printf costs no more than one bufwrite per chunk.
+struct out {
+  int fd;      // descriptor printf writes to, or -1 for snprintf
+  char *buf;
+  int size;    // room in buf
+  int n;       // characters in buf
+  int tot;     // characters printed, counting any cut off
+};
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == o->size && o->fd >= 0){
+    bufwrite(o->fd, o->buf, o->n);
+    o->n = 0;
+  }
+  if(o->n < o->size)
+    o->buf[o->n++] = c;
+  o->tot++;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,33 +49,32 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
-void
-printf(int fd, const char *fmt, ...)
+// Format fmt and the arguments at ap into o.
+// Only understands %d, %x, %p, %s, %c.
+static void
+format(struct out *o, const char *fmt, uint *ap)
 {
   char *s;
   int c, i, state;
-  uint *ap;
 
   state = 0;
-  ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
     if(state == 0){
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(o, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(o, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +82,53 @@ printf(int fd, const char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(o, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(o, '%');
+        putc(o, c);
       }
       state = 0;
     }
   }
 }
+
+// Print to the given fd, through its buffer; see bufwrite.
+void
+printf(int fd, const char *fmt, ...)
+{
+  char buf[128];
+  struct out o;
+
+  o.fd = fd;
+  o.buf = buf;
+  o.size = sizeof(buf);
+  o.n = o.tot = 0;
+  format(&o, fmt, (uint*)(void*)&fmt + 1);
+  bufwrite(fd, buf, o.n);
+}
+
+// Print into buf, which holds size characters counting the
+// terminating nul. Returns the length of the whole output,
+// which was cut short if that is size or more.
+int
+snprintf(char *buf, int size, const char *fmt, ...)
+{
+  struct out o;
+
+  o.fd = -1;
+  o.buf = buf;
+  o.size = size > 0 ? size - 1 : 0;
+  o.n = o.tot = 0;
+  format(&o, fmt, (uint*)(void*)&fmt + 1);
+  if(size > 0)
+    buf[o.n] = 0;
+  return o.tot;
+}
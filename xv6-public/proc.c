@@ -7,9 +7,16 @@
 #include "proc.h"
 #include "spinlock.h"
 
+// struct procs are carved out of kalloc()ed pages on demand,
+// up to NPROC of them, and never returned to the page allocator.
+// Allocated procs sit on the doubly-linked live list and in the
+// pid hash; UNUSED ones sit on the free list.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *live;             // procs in any state but UNUSED
+  struct proc *free;             // UNUSED procs ready for allocproc
+  struct proc *pidhash[NPIDHASH];
+  int nproc;                     // procs carved from the pool so far
 } ptable;
 
 static struct proc *initproc;
@@ -24,9 +31,95 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+
+// Find the proc with the given pid.
+// The ptable lock must be held.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[PIDHASH(pid)]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Add another page worth of procs to the free list.
+// Returns -1 if NPROC procs exist or memory is exhausted.
+// The ptable lock must be held.
+static int
+growptable(void)
+{
+  struct proc *p, *pool;
+  int i, n;
+
+  if(ptable.nproc >= NPROC)
+    return -1;
+  if((pool = (struct proc*)kalloc()) == 0)
+    return -1;
+  memset(pool, 0, PGSIZE);
+  n = PGSIZE / sizeof(struct proc);
+  if(n > NPROC - ptable.nproc)
+    n = NPROC - ptable.nproc;
+  for(i = 0; i < n; i++){
+    p = &pool[i];
+    p->state = UNUSED;
+    p->next = ptable.free;
+    ptable.free = p;
+  }
+  ptable.nproc += n;
+  return 0;
+}
+
+// Return p to the free list, dropping it from the
+// live list and the pid hash.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.live = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+
+  p->pid = 0;
+  p->parent = 0;
+  p->children = 0;
+  p->nextsib = 0;
+  p->prevsib = 0;
+  p->zombies = 0;
+  p->nextzombie = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+  p->prev = 0;
+  p->hnext = 0;
+  p->next = ptable.free;
+  ptable.free = p;
+}
+
 int
 setnice(int pid, int nice_value)
 {
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  p = findproc(pid);
+  release(&ptable.lock);
+  if(p == 0)
+    return -1;
   return 0;
 }
 
@@ -38,26 +131,55 @@ gettreeinfo(int *count, int *total_weight, int *period)
   *period = runnable_tasks->period;
 }
 
+static void
+fillprocinfo(struct proc *p, struct proc_info *info)
+{
+  info->pid = p->pid;
+  info->nice_value = p->nice_value;
+  info->weight = p->weight;
+  info->vruntime = p->vruntime;
+  info->curr_runtime = p->curr_runtime;
+  info->nsyscall = p->nsyscall;
+}
+
 void
 getprocinfo(int pid, struct proc_info *info)
 {
   struct proc *p;
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      info->pid = p->pid;
-      info->nice_value = p->nice_value;
-      info->weight = p->weight;
-      info->vruntime = p->vruntime;
-      info->curr_runtime = p->curr_runtime;
-      release(&ptable.lock);
-      return;
-    }
+  if((p = findproc(pid)) != 0){
+    fillprocinfo(p, info);
+    release(&ptable.lock);
+    return;
   }
   release(&ptable.lock);
   info->pid = -1;
 }
 
+// Fill info[i] for each of the n pids under a single
+// acquisition of ptable.lock. Entries for pids that do
+// not exist get pid -1. Returns the number found.
+int
+getprocinfo_many(int *pids, int n, struct proc_info *info)
+{
+  struct proc *p;
+  int i, found;
+
+  found = 0;
+  acquire(&ptable.lock);
+  for(i = 0; i < n; i++){
+    if((p = findproc(pids[i])) != 0){
+      fillprocinfo(p, &info[i]);
+      found++;
+    } else {
+      memset(&info[i], 0, sizeof(info[i]));
+      info[i].pid = -1;
+    }
+  }
+  release(&ptable.lock);
+  return found;
+}
+
 
 int check_rb_tree_properties(struct proc *node, int black_count, int *path_black_count);
 
@@ -157,12 +279,41 @@ myproc(void) {
   return p;
 }
 
+// Add p to the front of parent's children.
+// The ptable lock must be held.
+static void
+linkchild(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->prevsib = 0;
+  p->nextsib = parent->children;
+  if(parent->children)
+    parent->children->prevsib = p;
+  parent->children = p;
+}
+
+// Remove p from its parent's children.
+// The ptable lock must be held.
+static void
+unlinkchild(struct proc *p)
+{
+  if(p->prevsib)
+    p->prevsib->nextsib = p->nextsib;
+  else
+    p->parent->children = p->nextsib;
+  if(p->nextsib)
+    p->nextsib->prevsib = p->prevsib;
+  p->nextsib = 0;
+  p->prevsib = 0;
+}
+
 struct rbtree* gettree(void){
   return runnable_tasks;
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc off the free list, growing the
+// process table if the free list is empty.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -174,22 +325,34 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
+  if(ptable.free == 0 && growptable() < 0){
+    release(&ptable.lock);
+    return 0;
+  }
 
-  release(&ptable.lock);
-  return 0;
+  p = ptable.free;
+  ptable.free = p->next;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->nsyscall = 0;
+  p->mmapbusy = 0;
+
+  p->prev = 0;
+  p->next = ptable.live;
+  if(ptable.live)
+    ptable.live->prev = p;
+  ptable.live = p;
+  p->hnext = ptable.pidhash[PIDHASH(p->pid)];
+  ptable.pidhash[PIDHASH(p->pid)] = p;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -289,11 +452,12 @@ fork(void)
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -303,6 +467,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  mmapfork(curproc, np);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -310,6 +475,7 @@ fork(void)
 
   acquire(&ptable.lock);
 
+  linkchild(curproc, np);
   np->state = RUNNABLE;
 
   release(&ptable.lock);
@@ -324,12 +490,14 @@ void
 exit(void)
 {
   struct proc *curproc = myproc();
-  struct proc *p;
+  struct proc *p, *next;
   int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
+  munmapall(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -348,15 +516,26 @@ exit(void)
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
-  // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  // Pass abandoned children, and any of them
+  // already waiting to be reaped, to init.
+  for(p = curproc->children; p; p = next){
+    next = p->nextsib;
+    linkchild(initproc, p);
+  }
+  curproc->children = 0;
+  if(curproc->zombies){
+    for(p = curproc->zombies; p->nextzombie; p = p->nextzombie)
+      ;
+    p->nextzombie = initproc->zombies;
+    initproc->zombies = curproc->zombies;
+    curproc->zombies = 0;
+    wakeup1(initproc);
   }
 
+  // Queue for the parent's wait().
+  curproc->nextzombie = curproc->parent->zombies;
+  curproc->parent->zombies = curproc;
+
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
   sched();
@@ -369,35 +548,26 @@ int
 wait(void)
 {
   struct proc *p;
-  int havekids, pid;
+  int pid;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-        release(&ptable.lock);
-        return pid;
-      }
+    // Reap the first exited child, if any.
+    if((p = curproc->zombies) != 0){
+      curproc->zombies = p->nextzombie;
+      unlinkchild(p);
+      pid = p->pid;
+      kfree(p->kstack);
+      p->kstack = 0;
+      freevm(p->pgdir);
+      freeproc(p);
+      release(&ptable.lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
+    if(curproc->children == 0 || curproc->killed){
       release(&ptable.lock);
       return -1;
     }
@@ -428,7 +598,7 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.live; p; p = p->next){
       if(p->state != RUNNABLE)
         continue;
 
@@ -555,7 +725,7 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.live; p; p = p->next)
     if(p->state == SLEEPING && p->chan == chan)
       p->state = RUNNABLE;
 }
@@ -578,15 +748,13 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING)
+      p->state = RUNNABLE;
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -612,9 +780,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  for(p = ptable.live; p; p = p->next){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -628,3 +794,32 @@ procdump(void)
     cprintf("\n");
   }
 }
+
+// For the CLOCK sweep over mapped file pages in mmap.c: take
+// p's page at va away, unless p has used it since the last
+// look (then just clear PTE_A), or it is dirty and dirtyok is
+// clear. Returns the page's PTE if it was taken, else 0. None
+// of p's pages are taken while p is in a system call, which
+// may be using them, or running on another CPU, whose TLB may
+// hold them; ptable.lock keeps p from starting to run meanwhile.
+pte_t
+mmapsteal(struct proc *p, uint va, int dirtyok)
+{
+  pte_t *pte, old;
+
+  old = 0;
+  acquire(&ptable.lock);
+  if(!p->mmapbusy && (p == myproc() || p->state != RUNNING) &&
+     (pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)){
+    if(*pte & PTE_A)
+      *pte &= ~PTE_A;
+    else if(dirtyok || (*pte & PTE_D) == 0){
+      old = *pte;
+      *pte = 0;
+      if(p == myproc())
+        lcr3(V2P(p->pgdir));  // flush the TLB
+    }
+  }
+  release(&ptable.lock);
+  return old;
+}
@@ -16,6 +16,7 @@ struct proc_info {
   int weight;
   double vruntime;
   int curr_runtime;
+  uint nsyscall;
 };
 
 struct rb_node_info {
@@ -32,6 +33,7 @@ extern int ncpu;
 int setnice(int pid, int nice_value);
 void gettreeinfo(int *count, int *total_weight, int *period);
 void getprocinfo(int pid, struct proc_info *info);
+int getprocinfo_many(int *pids, int n, struct proc_info *info);
 int treebalanced(void);
 
 //PAGEBREAK: 17
@@ -58,6 +60,16 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 //This enumerator will be used to determine the color of each process in the red-black tree
 enum procColor {RED, BLACK};	
 
+// A file mapped into a process's memory by mmap.
+// Pages are filled in on first touch by mmapfault.
+struct vma {
+  uint addr;          // Start address, page-aligned; 0 if unused
+  uint len;           // Length in bytes, a multiple of PGSIZE
+  uint off;           // File offset of addr, block-aligned
+  int prot;           // PROT_READ, PROT_WRITE
+  struct inode *ip;   // File mapped
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -72,7 +84,10 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NMMAP];       // File mappings
+  int mmapbusy;                // Kernel may be using mapped pages
   char name[16];               // Process name (debugging)
+  uint nsyscall;               // System calls made
   
   // members for CFS
   double vruntime;    	// Time elapsed since the process was created
@@ -87,6 +102,18 @@ struct proc {
   struct proc *r;
   struct proc *l;
   struct proc *p;
+
+  // members for the process table
+  struct proc *next;           // Next proc on ptable live or free list
+  struct proc *prev;           // Previous proc on ptable live list
+  struct proc *hnext;          // Next proc in the same pid hash bucket
+
+  // members for the process tree
+  struct proc *children;       // First child in the sibling list
+  struct proc *nextsib;        // Next child of the same parent
+  struct proc *prevsib;        // Previous child of the same parent
+  struct proc *zombies;        // Exited children waiting to be reaped
+  struct proc *nextzombie;     // Next proc on the parent's zombie queue
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -94,6 +121,8 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   file mappings, from MMAPBASE up
 //Red-Black Tree data structure
 struct rbtree {
   int length;
@@ -45,6 +45,24 @@ fetchstr(uint addr, char **pp)
   return -1;
 }
 
+// Check that the size bytes at addr lie within the current
+// process's address space, mapping in pages of file mappings,
+// and set *pp to point at them. write says whether the kernel
+// will store into them, which read-only mappings forbid.
+int
+fetchptr(uint addr, char **pp, int size, int write)
+{
+  struct proc *curproc = myproc();
+
+  if(size < 0)
+    return -1;
+  if((addr >= curproc->sz || addr+size > curproc->sz) &&
+     mmapin(curproc, addr, size, write) < 0)
+    return -1;
+  *pp = (char*)addr;
+  return 0;
+}
+
 // Fetch the nth 32-bit system call argument.
 int
 argint(int n, int *ip)
@@ -53,20 +71,30 @@ argint(int n, int *ip)
 }
 
 // Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// to a block of memory of size bytes, which the kernel may store
+// into.  Check that the pointer lies within the process address
+// space; pages of file mappings are mapped in now, so the kernel
+// does not fault on them.
 int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  return fetchptr(i, pp, size, 1);
+}
+
+// Like argptr, for memory the kernel only reads, which may
+// lie in a read-only file mapping.
+int
+argptrro(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
     return -1;
-  *pp = (char*)i;
-  return 0;
+  return fetchptr(i, pp, size, 0);
 }
 
 // Fetch the nth word-sized system call argument as a string pointer.
@@ -107,6 +135,16 @@ extern int sys_gettreeinfo(void);
 extern int sys_getprocinfo(void);
 extern int sys_gettreenodes(void);
 extern int sys_treebalanced(void);
+extern int sys_getprocinfo_many(void);
+extern int sys_iostat(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_splice(void);
+extern int sys_epoll_create(void);
+extern int sys_epoll_ctl(void);
+extern int sys_epoll_wait(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -134,6 +172,16 @@ static int (*syscalls[])(void) = {
 [SYS_getprocinfo] sys_getprocinfo,
 [SYS_gettreenodes] sys_gettreenodes,
 [SYS_treebalanced] sys_treebalanced,
+[SYS_getprocinfo_many] sys_getprocinfo_many,
+[SYS_iostat]  sys_iostat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_splice]  sys_splice,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl] sys_epoll_ctl,
+[SYS_epoll_wait] sys_epoll_wait,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
 };
 
 void
@@ -143,8 +191,11 @@ syscall(void)
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
+  curproc->nsyscall++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    curproc->mmapbusy = 1;  // see mmapsteal
     curproc->tf->eax = syscalls[num]();
+    curproc->mmapbusy = 0;
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
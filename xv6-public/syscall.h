@@ -24,3 +24,13 @@
 #define SYS_gettreeinfo 23
 #define SYS_getprocinfo 24
 #define SYS_gettreenodes 25
+#define SYS_getprocinfo_many 26
+#define SYS_iostat 27
+#define SYS_mmap   28
+#define SYS_munmap 29
+#define SYS_splice 30
+#define SYS_epoll_create 31
+#define SYS_epoll_ctl 32
+#define SYS_epoll_wait 33
+#define SYS_readv  34
+#define SYS_writev 35
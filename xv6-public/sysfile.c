@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iostat.h"
+#include "epoll.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -85,11 +88,61 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrro(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array that is argument n, cnt long, into
+// iov, checking that each segment lies in the process's memory,
+// writable if write is set, and that together they are not too
+// long to count.
+static int
+argiov(int n, struct iovec *iov, int cnt, int write)
+{
+  struct iovec *uiov;
+  uint tot;
+  int i;
+
+  if(cnt < 0 || cnt > IOV_MAX || argptrro(n, (void*)&uiov, cnt*sizeof(*iov)) < 0)
+    return -1;
+  memmove(iov, uiov, cnt*sizeof(*iov));
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff - tot ||
+       fetchptr((uint)iov[i].iov_base, (void*)&iov[i].iov_base, iov[i].iov_len, write) < 0)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  return 0;
+}
+
+// int readv(int fd, struct iovec *iov, int cnt)
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt, 1) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+// int writev(int fd, struct iovec *iov, int cnt)
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt, 0) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
 int
 sys_close(void)
 {
@@ -218,6 +271,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -442,3 +496,109 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_iostat(void)
+{
+  struct iostats *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  idestats(st);
+  return 0;
+}
+
+// void *mmap(void *addr, int len, int prot, int flags, int fd, int off)
+// addr is a hint, and ignored; the only flag is MAP_SHARED.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || flags != MAP_SHARED)
+    return -1;
+  return mmap(f, len, prot, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// int splice(int fdin, int fdout, int n)
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// int epoll_create(void)
+int
+sys_epoll_create(void)
+{
+  struct file *f;
+  int fd;
+
+  if((f = filealloc()) == 0)
+    return -1;
+  if((f->ep = epollalloc()) == 0){
+    fileclose(f);
+    return -1;
+  }
+  f->type = FD_EPOLL;
+  f->readable = 0;
+  f->writable = 0;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// int epoll_ctl(int epfd, int op, int fd, int events)
+int
+sys_epoll_ctl(void)
+{
+  struct file *ef, *f;
+  int op, fd, events;
+
+  if(argfd(0, 0, &ef) < 0 || argint(1, &op) < 0 ||
+     argfd(2, &fd, &f) < 0 || argint(3, &events) < 0)
+    return -1;
+  if(ef->type != FD_EPOLL)
+    return -1;
+  return epollctl(ef->ep, op, fd, f, events);
+}
+
+// int epoll_wait(int epfd, struct epoll_event *evs, int max, int timeout)
+int
+sys_epoll_wait(void)
+{
+  struct file *ef;
+  struct epoll_event *evs;
+  int max, timeout;
+
+  if(argfd(0, 0, &ef) < 0 || argint(2, &max) < 0 || argint(3, &timeout) < 0)
+    return -1;
+  if(max > NEPITEM)
+    max = NEPITEM;  // no more can be ready; keeps max*sizeof small
+  if(max <= 0 || argptr(1, (void*)&evs, max*sizeof(*evs)) < 0)
+    return -1;
+  if(ef->type != FD_EPOLL)
+    return -1;
+  return epollwait(ef->ep, evs, max, timeout);
+}
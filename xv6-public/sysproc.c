@@ -139,6 +139,25 @@ sys_getprocinfo(void)
   return 0;
 }
 
+// Batched getprocinfo: fill info[0..n-1] for pids[0..n-1]
+// directly in user memory, returning the number of pids found.
+int
+sys_getprocinfo_many(void)
+{
+  int n;
+  int *pids;
+  struct proc_info *info;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPROC)
+    return -1;
+  if(argptrro(0, (char**)&pids, n*sizeof(int)) < 0)
+    return -1;
+  if(argptr(2, (char**)&info, n*sizeof(struct proc_info)) < 0)
+    return -1;
+
+  return getprocinfo_many(pids, n, info);
+}
+
 int collect_rb_tree_nodes(struct proc *node, struct rb_node_info *nodes, int *index, int max_nodes);
 
 int
@@ -0,0 +1,77 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+// Writing two files a block at a time in turn gives each block
+// its own extent, so this many blocks fill the inode and the
+// first extent block and spill into the index trees.
+#define NUM_BLOCKS (NEXTENT + NINDEXTENT + 64)
+
+char buf[BSIZE];
+
+int
+check(int fd, int which)
+{
+  int i;
+
+  for(i = 0; i < NUM_BLOCKS; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf(1, "Test Failed: Short read of block %d\n", i);
+      return 0;
+    }
+    if(((int*)buf)[0] != i || ((int*)buf)[BSIZE/sizeof(int)-1] != which){
+      printf(1, "Test Failed: Block %d of file %d holds %d\n", i, which, ((int*)buf)[0]);
+      return 0;
+    }
+  }
+  if(read(fd, buf, BSIZE) != 0){
+    printf(1, "Test Failed: File %d is too long\n", which);
+    return 0;
+  }
+  return 1;
+}
+
+int
+main(void)
+{
+  int fd[2], i, j, passed;
+
+  for(j = 0; j < 2; j++){
+    fd[j] = open(j ? "bigfile1" : "bigfile0", O_CREATE|O_RDWR);
+    if(fd[j] < 0){
+      printf(1, "Test Failed: Cannot create file %d\n", j);
+      exit();
+    }
+  }
+
+  for(i = 0; i < NUM_BLOCKS; i++){
+    for(j = 0; j < 2; j++){
+      ((int*)buf)[0] = i;
+      ((int*)buf)[BSIZE/sizeof(int)-1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf(1, "Test Failed: Write of block %d failed\n", i);
+        exit();
+      }
+    }
+  }
+  close(fd[0]);
+  close(fd[1]);
+
+  passed = 1;
+  for(j = 0; j < 2 && passed; j++){
+    fd[j] = open(j ? "bigfile1" : "bigfile0", O_RDONLY);
+    passed = check(fd[j], j);
+    close(fd[j]);
+  }
+
+  unlink("bigfile0");
+  unlink("bigfile1");
+
+  if(passed){
+    printf(1, "Test Passed: Fragmented files read back intact\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,92 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+int passed = 1;
+
+void
+expect(char *path, int exists)
+{
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if((fd >= 0) != exists){
+    printf(1, "Test Failed: %s should%s exist\n", path, exists ? "" : " not");
+    passed = 0;
+  }
+  if(fd >= 0)
+    close(fd);
+}
+
+void
+touch(char *path)
+{
+  int fd;
+
+  if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+    printf(1, "Test Failed: Cannot create %s\n", path);
+    passed = 0;
+    return;
+  }
+  close(fd);
+}
+
+int
+main(void)
+{
+  int i;
+
+  if(mkdir("dcdir") < 0){
+    printf(1, "Test Failed: mkdir dcdir\n");
+    exit();
+  }
+
+  // Misses are cached too; creating the name must replace them.
+  expect("dcdir/a", 0);
+  touch("dcdir/a");
+  for(i = 0; i < 3; i++)
+    expect("dcdir/a", 1);
+
+  // Unlinking must forget the name.
+  unlink("dcdir/a");
+  expect("dcdir/a", 0);
+
+  // A new link is found at once.
+  touch("dcdir/b");
+  expect("dcdir/c", 0);
+  if(link("dcdir/b", "dcdir/c") < 0){
+    printf(1, "Test Failed: link\n");
+    passed = 0;
+  }
+  expect("dcdir/c", 1);
+  unlink("dcdir/b");
+  unlink("dcdir/c");
+
+  // A directory made in place of a removed one starts empty,
+  // even if it reuses the old inode number.
+  touch("dcdir/d");
+  unlink("dcdir/d");
+  if(unlink("dcdir") < 0){
+    printf(1, "Test Failed: unlink dcdir\n");
+    passed = 0;
+  }
+  expect("dcdir/a", 0);
+  mkdir("dcdir");
+  touch("dcdir/e");
+  mkdir("dcdir2");
+  expect("dcdir2/e", 0);
+  expect("dcdir/e", 1);
+  expect("dcdir/./e", 1);
+  expect("dcdir/../dcdir/e", 1);
+  unlink("dcdir/e");
+  unlink("dcdir");
+  unlink("dcdir2");
+
+  if(passed){
+    printf(1, "Test Passed: Name lookups follow creates, links and unlinks\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
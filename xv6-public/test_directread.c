@@ -0,0 +1,76 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+// More blocks than the buffer cache keeps, so that reading the
+// file back finds most of them on disk only.
+#define NUM_BLOCKS 1200
+#define CHUNK 16
+
+int
+main(void)
+{
+  char *buf, *p;
+  int fd, i, j, n, passed;
+
+  fd = open("directfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "Test Failed: Cannot create file\n");
+    exit();
+  }
+
+  // A page-aligned buffer of CHUNK blocks, and one spare
+  // block for reading at an unaligned address.
+  p = sbrk((CHUNK + 2) * BSIZE);
+  buf = (char*)(((uint)p + BSIZE - 1) & ~(BSIZE - 1));
+
+  for(i = 0; i < NUM_BLOCKS; i++){
+    for(j = 0; j < BSIZE/sizeof(int); j++)
+      ((int*)buf)[j] = i * 7 + j;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(1, "Test Failed: Write of block %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  passed = 1;
+  fd = open("directfile", O_RDONLY);
+  for(i = 0; i < NUM_BLOCKS && passed; i += n){
+    // Alternate aligned reads of many blocks with an unaligned one.
+    if(i % (CHUNK + 1) == CHUNK){
+      n = 1;
+      if(read(fd, buf + 4, BSIZE) != BSIZE){
+        printf(1, "Test Failed: Short read at block %d\n", i);
+        passed = 0;
+      }
+      memmove(buf, buf + 4, BSIZE);
+    } else {
+      n = NUM_BLOCKS - i < CHUNK ? NUM_BLOCKS - i : CHUNK;
+      if(read(fd, buf, n * BSIZE) != n * BSIZE){
+        printf(1, "Test Failed: Short read at block %d\n", i);
+        passed = 0;
+      }
+    }
+    for(j = 0; j < n * BSIZE/sizeof(int) && passed; j++){
+      if(((int*)buf)[j] != (i + j/(BSIZE/sizeof(int))) * 7 + j%(BSIZE/sizeof(int))){
+        printf(1, "Test Failed: Wrong data in block %d\n", i + j/(BSIZE/sizeof(int)));
+        passed = 0;
+      }
+    }
+  }
+  if(passed && read(fd, buf, BSIZE) != 0){
+    printf(1, "Test Failed: File is too long\n");
+    passed = 0;
+  }
+  close(fd);
+  unlink("directfile");
+
+  if(passed){
+    printf(1, "Test Passed: Aligned and unaligned reads returned the file's data\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
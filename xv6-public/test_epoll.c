@@ -0,0 +1,112 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "epoll.h"
+
+#define NPIPES 4
+
+int passed = 1;
+
+void
+fail(char *msg)
+{
+  printf(1, "Test Failed: %s\n", msg);
+  passed = 0;
+}
+
+int
+main(void)
+{
+  int ep, p[NPIPES][2], q[2], i, n, fd;
+  struct epoll_event ev[NPIPES];
+  char c;
+
+  if((ep = epoll_create()) < 0){
+    printf(1, "Test Failed: epoll_create failed\n");
+    exit();
+  }
+  for(i = 0; i < NPIPES; i++){
+    pipe(p[i]);
+    if(epoll_ctl(ep, EPOLL_CTL_ADD, p[i][0], EPOLLIN) < 0)
+      fail("Cannot watch a pipe");
+  }
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, p[0][0], EPOLLIN) != -1)
+    fail("Watched the same pipe twice");
+
+  // Nothing is ready yet.
+  if(epoll_wait(ep, ev, NPIPES, 0) != 0)
+    fail("Empty pipes reported ready");
+
+  // A child writes into one pipe later; the wait sleeps until then.
+  if(fork() == 0){
+    sleep(10);
+    write(p[2][1], "x", 1);
+    exit();
+  }
+  n = epoll_wait(ep, ev, NPIPES, -1);
+  if(n != 1 || ev[0].fd != p[2][0] || !(ev[0].events & EPOLLIN))
+    fail("Wait did not report the pipe written to");
+  wait();
+
+  // Readiness is level-triggered: reported until drained.
+  if(epoll_wait(ep, ev, NPIPES, 0) != 1)
+    fail("Unread data no longer reported");
+  read(p[2][0], &c, 1);
+  if(epoll_wait(ep, ev, NPIPES, 0) != 0)
+    fail("Drained pipe still reported");
+
+  // A timed wait gives up.
+  if(epoll_wait(ep, ev, NPIPES, 5) != 0)
+    fail("Timed wait reported something");
+
+  // Closing the write end reports a hangup.
+  close(p[1][1]);
+  n = epoll_wait(ep, ev, NPIPES, -1);
+  if(n != 1 || ev[0].fd != p[1][0] || !(ev[0].events & EPOLLHUP))
+    fail("Hangup not reported");
+
+  // Removed pipes are no longer reported.
+  if(epoll_ctl(ep, EPOLL_CTL_DEL, p[1][0], 0) < 0)
+    fail("Cannot stop watching a pipe");
+  if(epoll_wait(ep, ev, NPIPES, 0) != 0)
+    fail("Removed pipe still reported");
+
+  // Regular files are always ready.
+  fd = open("epollfile", O_CREATE|O_RDWR);
+  epoll_ctl(ep, EPOLL_CTL_ADD, fd, EPOLLIN|EPOLLOUT);
+  n = epoll_wait(ep, ev, NPIPES, 0);
+  if(n != 1 || ev[0].fd != fd || ev[0].events != (EPOLLIN|EPOLLOUT))
+    fail("File not reported ready");
+  close(fd);
+  unlink("epollfile");
+  if(epoll_wait(ep, ev, NPIPES, 0) != 0)
+    fail("Closed file still reported");
+
+  // Closing a watched write end ends its watch, and the reader
+  // sees a hangup and end of file.
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, p[3][1], EPOLLOUT) < 0)
+    fail("Cannot watch a write end");
+  close(p[3][1]);
+  n = epoll_wait(ep, ev, NPIPES, -1);
+  if(n != 1 || ev[0].fd != p[3][0] || !(ev[0].events & EPOLLHUP))
+    fail("Hangup not reported for a watched write end");
+  if(read(p[3][0], &c, 1) != 0)
+    fail("Reader did not see end of file");
+
+  // The closed end's descriptor may be reused unreported.
+  pipe(q);
+  n = epoll_wait(ep, ev, NPIPES, 0);
+  if(n != 1 || ev[0].fd != p[3][0])
+    fail("Closed write end still reported");
+  close(q[0]);
+  close(q[1]);
+
+  close(ep);
+
+  if(passed){
+    printf(1, "Test Passed: epoll reported ready pipes and files\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,58 @@
+#include "types.h"
+#include "user.h"
+
+#define NUM_PROCS 50
+
+int
+main(void)
+{
+  int pids[NUM_PROCS+1];
+  struct proc_info info[NUM_PROCS+1];
+  int i, found, passed;
+
+  for(i = 0; i < NUM_PROCS; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf(1, "Fork failed\n");
+      exit();
+    }
+    if(pids[i] == 0){
+      sleep(100);
+      exit();
+    }
+  }
+  // A pid that cannot exist yet.
+  pids[NUM_PROCS] = pids[NUM_PROCS-1] + 1000;
+
+  found = getprocinfo_many(pids, NUM_PROCS+1, info);
+
+  passed = 1;
+  if(found != NUM_PROCS){
+    printf(1, "Test Failed: Expected %d processes, found %d\n", NUM_PROCS, found);
+    passed = 0;
+  }
+  for(i = 0; i < NUM_PROCS; i++){
+    if(info[i].pid != pids[i]){
+      printf(1, "Test Failed: Expected pid %d, got %d\n", pids[i], info[i].pid);
+      passed = 0;
+    }
+  }
+  if(info[NUM_PROCS].pid != -1){
+    printf(1, "Test Failed: Missing pid reported as %d\n", info[NUM_PROCS].pid);
+    passed = 0;
+  }
+
+  for(i = 0; i < NUM_PROCS; i++){
+    kill(pids[i]);
+  }
+  for(i = 0; i < NUM_PROCS; i++){
+    wait();
+  }
+
+  if(passed){
+    printf(1, "Test Passed: getprocinfo_many returned every process in one call\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
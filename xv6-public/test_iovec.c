@@ -0,0 +1,158 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "uio.h"
+
+#define BIG (128*1024)  // more than one log operation writes
+
+int passed = 1;
+
+void
+fail(char *msg)
+{
+  printf(1, "Test Failed: %s\n", msg);
+  passed = 0;
+}
+
+// Fill buf with a pattern that differs for each segment.
+void
+fill(char *buf, int n, int seed)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    buf[i] = (i * 7 + seed) & 0xff;
+}
+
+int
+differ(char *a, char *b, int n)
+{
+  while(n-- > 0)
+    if(*a++ != *b++)
+      return 1;
+  return 0;
+}
+
+int
+check(char *buf, int n, int seed)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(buf[i] != (char)((i * 7 + seed) & 0xff))
+      return 0;
+  return 1;
+}
+
+int
+main(void)
+{
+  struct iovec iov[4];
+  char hdr[10], trailer[3], got[16], tail[16];
+  char *big[2];
+  int fd, p[2], n;
+
+  // Header and payload go into a file in one call.
+  fd = open("iovecfile", O_CREATE|O_RDWR);
+  strcpy(hdr, "header:");
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 7;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "payload";
+  iov[2].iov_len = 7;
+  if(writev(fd, iov, 3) != 14)
+    fail("writev to a file");
+  close(fd);
+
+  // And come back out split differently.
+  fd = open("iovecfile", O_RDONLY);
+  iov[0].iov_base = got;
+  iov[0].iov_len = 10;
+  iov[1].iov_base = tail;
+  iov[1].iov_len = 10;
+  n = readv(fd, iov, 2);
+  if(n != 14 || differ(got, "header:pay", 10) || differ(tail, "load", 4))
+    fail("readv from a file");
+  if(readv(fd, iov, 2) != 0)
+    fail("readv past the end of a file");
+  close(fd);
+
+  // Segments larger than one log operation: the first spans two,
+  // and the second operation starts within it and ends within
+  // the third segment.
+  big[0] = malloc(BIG);
+  big[1] = malloc(BIG);
+  fill(big[0], BIG, 1);
+  fill(big[1], BIG, 2);
+  fd = open("iovecfile", O_RDWR);
+  iov[0].iov_base = big[0];
+  iov[0].iov_len = BIG;
+  iov[1].iov_base = hdr;
+  iov[1].iov_len = 7;
+  iov[2].iov_base = big[1];
+  iov[2].iov_len = BIG;
+  if(writev(fd, iov, 3) != 2*BIG + 7)
+    fail("large writev to a file");
+  close(fd);
+  memset(big[0], 0, BIG);
+  memset(big[1], 0, BIG);
+  memset(got, 0, sizeof(got));
+  fd = open("iovecfile", O_RDONLY);
+  iov[1].iov_base = got;
+  if(readv(fd, iov, 3) != 2*BIG + 7 || !check(big[0], BIG, 1) ||
+     differ(got, "header:", 7) || !check(big[1], BIG, 2))
+    fail("large readv from a file");
+  close(fd);
+  unlink("iovecfile");
+
+  // A pipe takes all the segments at once.
+  pipe(p);
+  iov[0].iov_base = "ab";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = "cde";
+  iov[1].iov_len = 3;
+  iov[2].iov_base = "f";
+  iov[2].iov_len = 1;
+  if(writev(p[1], iov, 3) != 6)
+    fail("writev to a pipe");
+  iov[0].iov_base = trailer;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = got;
+  iov[1].iov_len = 16;
+  if(readv(p[0], iov, 2) != 6 || differ(trailer, "abc", 3) ||
+     differ(got, "def", 3))
+    fail("readv from a pipe");
+
+  // More than the pipe holds, with a reader draining it.
+  if(fork() == 0){
+    close(p[1]);
+    while(readv(p[0], iov, 2) > 0)
+      ;
+    exit();
+  }
+  close(p[0]);
+  iov[0].iov_base = big[0];
+  iov[0].iov_len = BIG;
+  iov[1].iov_base = big[1];
+  iov[1].iov_len = BIG;
+  if(writev(p[1], iov, 2) != 2*BIG)
+    fail("large writev to a pipe");
+  close(p[1]);
+  wait();
+
+  // Bad arguments.
+  iov[0].iov_base = (void*)0x7ffff000;
+  iov[0].iov_len = 16;
+  if(writev(1, iov, 1) != -1)
+    fail("writev from a bad address");
+  if(writev(1, iov, IOV_MAX + 1) != -1 || writev(1, iov, -1) != -1)
+    fail("writev with a bad count");
+
+  if(passed){
+    printf(1, "Test Passed: readv and writev moved every segment\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,57 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+// One write() this large spans several log transactions.
+#define NBYTES (1024*1024)
+
+int
+main(void)
+{
+  int fd, i, passed;
+  int *buf;
+
+  buf = (int*)sbrk(NBYTES);
+  for(i = 0; i < NBYTES/sizeof(int); i++)
+    buf[i] = i;
+
+  fd = open("largefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "Test Failed: Cannot create file\n");
+    exit();
+  }
+  // Start unaligned, so the chunks straddle blocks.
+  if(write(fd, "x", 1) != 1 || write(fd, buf, NBYTES) != NBYTES){
+    printf(1, "Test Failed: Large write failed\n");
+    exit();
+  }
+  close(fd);
+
+  memset(buf, 0, NBYTES);
+  passed = 1;
+  fd = open("largefile", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || read(fd, buf, NBYTES) != NBYTES){
+    printf(1, "Test Failed: Short read\n");
+    passed = 0;
+  }
+  for(i = 0; i < NBYTES/sizeof(int) && passed; i++){
+    if(buf[i] != i){
+      printf(1, "Test Failed: Word %d holds %d\n", i, buf[i]);
+      passed = 0;
+    }
+  }
+  if(passed && read(fd, buf, 1) != 0){
+    printf(1, "Test Failed: File is too long\n");
+    passed = 0;
+  }
+  close(fd);
+  unlink("largefile");
+
+  if(passed){
+    printf(1, "Test Passed: A 1MB write reads back intact\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,162 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+#define NUM_BLOCKS 3
+#define BIG_BLOCKS 1024  // more than may be mapped at once
+
+char buf[BSIZE];
+int passed = 1;
+
+void
+fail(char *msg)
+{
+  printf(1, "Test Failed: %s\n", msg);
+  passed = 0;
+}
+
+int
+main(void)
+{
+  int fd, fd2, i;
+  char *p;
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "Test Failed: Cannot create file\n");
+    exit();
+  }
+  for(i = 0; i < NUM_BLOCKS; i++){
+    memset(buf, 'a' + i, BSIZE);
+    write(fd, buf, BSIZE);
+  }
+
+  p = mmap(0, NUM_BLOCKS * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf(1, "Test Failed: mmap failed\n");
+    exit();
+  }
+
+  // The mapping shows the file.
+  for(i = 0; i < NUM_BLOCKS; i++)
+    if(p[i * BSIZE] != 'a' + i || p[i * BSIZE + BSIZE - 1] != 'a' + i)
+      fail("Mapping does not match the file");
+
+  // Stores by a child land in the same pages.
+  if(fork() == 0){
+    p[0] = 'X';
+    p[2 * BSIZE + 7] = 'Y';
+    exit();
+  }
+  wait();
+  if(p[0] != 'X' || p[2 * BSIZE + 7] != 'Y')
+    fail("Child's stores are not visible to the parent");
+
+  // The mapping outlives the descriptor, and stores are
+  // visible to read() right away.
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  read(fd, buf, BSIZE);
+  if(buf[0] != 'X')
+    fail("Store through the mapping is not visible to read");
+  close(fd);
+
+  // Mapped memory can be handed to system calls.
+  fd = open("mmapcopy", O_CREATE|O_RDWR);
+  if(write(fd, p + BSIZE, BSIZE) != BSIZE)
+    fail("Cannot write from a mapping");
+  close(fd);
+
+  if(munmap(p, NUM_BLOCKS * BSIZE) < 0)
+    fail("munmap failed");
+
+  // The stores reached the file.
+  fd = open("mmapfile", O_RDONLY);
+  for(i = 0; i < NUM_BLOCKS; i++){
+    if(read(fd, buf, BSIZE) != BSIZE)
+      fail("Short read");
+    if(i == 0 && buf[0] != 'X')
+      fail("Store to block 0 was lost");
+    if(i == 2 && buf[7] != 'Y')
+      fail("Store to block 2 was lost");
+    if(buf[BSIZE - 1] != 'a' + i)
+      fail("File contents changed");
+  }
+  close(fd);
+  fd = open("mmapcopy", O_RDONLY);
+  if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'b' || buf[BSIZE - 1] != 'b')
+    fail("Data written from the mapping is wrong");
+  close(fd);
+
+  // Read-only files cannot be mapped writable.
+  fd = open("mmapfile", O_RDONLY);
+  if(mmap(0, BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    fail("Writable mapping of a read-only file");
+
+  // Nor can the kernel store into a read-only mapping for us.
+  p = mmap(0, BSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  fd2 = open("mmapcopy", O_RDONLY);
+  if(read(fd2, p, BSIZE) != -1)
+    fail("read() stored into a read-only mapping");
+  close(fd2);
+  if(p[0] != 'X')
+    fail("Read-only mapping changed");
+  munmap(p, BSIZE);
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'X')
+    fail("File changed through a read-only mapping");
+  close(fd);
+
+  unlink("mmapfile");
+  unlink("mmapcopy");
+
+  // A mapping larger than the pages that may be mapped at once:
+  // touching all of it takes pages back, clean and dirty.
+  fd = open("mmapbig", O_CREATE|O_RDWR);
+  memset(buf, 0, BSIZE);
+  for(i = 0; i < BIG_BLOCKS; i++){
+    buf[0] = i;
+    buf[1] = i >> 8;
+    write(fd, buf, BSIZE);
+  }
+  p = mmap(0, BIG_BLOCKS * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap of a large file failed");
+  else {
+    for(i = 0; i < BIG_BLOCKS; i++){
+      if(p[i * BSIZE] != (char)i || p[i * BSIZE + 1] != (char)(i >> 8)){
+        fail("Large mapping does not match the file");
+        break;
+      }
+    }
+    for(i = 0; i < BIG_BLOCKS; i += 2)
+      p[i * BSIZE + 2] = 'Z';
+    for(i = 0; i < BIG_BLOCKS; i++){
+      if(p[i * BSIZE + 2] != (i % 2 == 0 ? 'Z' : 0)){
+        fail("Store to a large mapping was lost before munmap");
+        break;
+      }
+    }
+    if(munmap(p, BIG_BLOCKS * BSIZE) < 0)
+      fail("munmap of a large mapping failed");
+  }
+  close(fd);
+  fd = open("mmapbig", O_RDONLY);
+  for(i = 0; i < BIG_BLOCKS; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[2] != (i % 2 == 0 ? 'Z' : 0)){
+      fail("Store to a large mapping did not reach the file");
+      break;
+    }
+  }
+  close(fd);
+  unlink("mmapbig");
+
+  if(passed){
+    printf(1, "Test Passed: Shared file mappings read and write the file\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,68 @@
+#include "types.h"
+#include "user.h"
+
+// Push this many bytes through a pipe, in writes and reads of
+// sizes that do not line up with each other or with the ring.
+#define NBYTES (256*1024)
+
+char wbuf[10000];
+char rbuf[7000];
+
+int
+main(void)
+{
+  int fds[2], pid, i, n, got, passed;
+  uint sent;
+
+  if(pipe(fds) < 0){
+    printf(1, "Test Failed: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "Test Failed: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    sent = 0;
+    for(n = 1; sent < NBYTES; n = n * 7 % sizeof(wbuf) + 1){
+      if(n > NBYTES - sent)
+        n = NBYTES - sent;
+      for(i = 0; i < n; i++)
+        wbuf[i] = (sent + i) % 251;
+      if(write(fds[1], wbuf, n) != n){
+        printf(1, "Test Failed: Short write\n");
+        exit();
+      }
+      sent += n;
+    }
+    exit();
+  }
+
+  close(fds[1]);
+  passed = 1;
+  got = 0;
+  while((n = read(fds[0], rbuf, got % sizeof(rbuf) + 1)) > 0){
+    for(i = 0; i < n && passed; i++){
+      if(rbuf[i] != (char)((got + i) % 251)){
+        printf(1, "Test Failed: Byte %d is wrong\n", got + i);
+        passed = 0;
+      }
+    }
+    got += n;
+  }
+  close(fds[0]);
+  wait();
+
+  if(passed && got != NBYTES){
+    printf(1, "Test Failed: Read %d bytes, expected %d\n", got, NBYTES);
+    passed = 0;
+  }
+  if(passed){
+    printf(1, "Test Passed: Pipe carried every byte in order\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,112 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NBYTES 50000
+
+char buf[NBYTES];
+char rbuf[NBYTES];
+int passed = 1;
+
+void
+check(char *what, char *got, int n, int off)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(got[i] != (char)((off + i) % 253)){
+      printf(1, "Test Failed: %s: byte %d is wrong\n", what, off + i);
+      passed = 0;
+      return;
+    }
+  }
+}
+
+int
+main(void)
+{
+  int fd, out, fds[2], i, n, got;
+
+  for(i = 0; i < NBYTES; i++)
+    buf[i] = i % 253;
+  fd = open("splicein", O_CREATE|O_RDWR);
+  write(fd, buf, NBYTES);
+  close(fd);
+
+  // File to pipe: the reader gets the file, the splicer gets
+  // its byte count and stops at the end of the file.
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    fd = open("splicein", O_RDONLY);
+    read(fd, buf, 100);  // splice from the file offset
+    n = splice(fd, fds[1], NBYTES);
+    if(n != NBYTES - 100)
+      printf(1, "Test Failed: splice moved %d bytes, expected %d\n", n, NBYTES - 100);
+    exit();
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], rbuf + got, NBYTES - got)) > 0)
+    got += n;
+  close(fds[0]);
+  wait();
+  if(got != NBYTES - 100){
+    printf(1, "Test Failed: Pipe gave %d bytes, expected %d\n", got, NBYTES - 100);
+    passed = 0;
+  } else
+    check("file to pipe", rbuf, got, 100);
+
+  // Pipe to file.
+  pipe(fds);
+  write(fds[1], buf, 1000);
+  close(fds[1]);
+  out = open("spliceout", O_CREATE|O_RDWR);
+  got = 0;
+  while((n = splice(fds[0], out, NBYTES)) > 0)
+    got += n;
+  close(fds[0]);
+  close(out);
+  out = open("spliceout", O_RDONLY);
+  if(got != 1000 || read(out, rbuf, NBYTES) != 1000){
+    printf(1, "Test Failed: Pipe to file moved %d bytes\n", got);
+    passed = 0;
+  } else
+    check("pipe to file", rbuf, 1000, 0);
+  close(out);
+
+  // File to file.
+  fd = open("splicein", O_RDONLY);
+  out = open("spliceout", O_RDWR);
+  if(splice(fd, out, NBYTES) != NBYTES){
+    printf(1, "Test Failed: File to file was short\n");
+    passed = 0;
+  }
+  close(fd);
+  close(out);
+  out = open("spliceout", O_RDONLY);
+  if(read(out, rbuf, NBYTES) != NBYTES){
+    printf(1, "Test Failed: File to file copy is short\n");
+    passed = 0;
+  } else
+    check("file to file", rbuf, NBYTES, 0);
+  close(out);
+
+  // Wrong directions fail.
+  fd = open("splicein", O_RDONLY);
+  if(splice(fd, fd, 10) != -1){
+    printf(1, "Test Failed: Splice into a read-only file succeeded\n");
+    passed = 0;
+  }
+  close(fd);
+
+  unlink("splicein");
+  unlink("spliceout");
+
+  if(passed){
+    printf(1, "Test Passed: splice moved data between files and pipes\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
@@ -0,0 +1,119 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NLINE 100
+
+int passed = 1;
+
+void
+fail(char *msg)
+{
+  printf(1, "Test Failed: %s\n", msg);
+  passed = 0;
+}
+
+uint
+nsyscall(void)
+{
+  struct proc_info info;
+
+  getprocinfo(getpid(), &info);
+  return info.nsyscall;
+}
+
+// System calls taken to print NLINE lines to a file, with
+// output buffered as mode says, or one write per character
+// as printf used to if mode is 0. Each line is printed by two
+// printf calls.
+int
+cost(int mode)
+{
+  char line[64], *s;
+  uint n0;
+  int fd, i;
+
+  fd = open("stdiofile", O_CREATE|O_RDWR);
+  if(mode)
+    setvbuf(fd, mode);
+  n0 = nsyscall();
+  for(i = 0; i < NLINE; i++){
+    if(mode){
+      printf(fd, "line %d of %d: ", i, NLINE);
+      printf(fd, "%s\n", "some text");
+    } else {
+      snprintf(line, sizeof(line), "line %d of %d: %s\n", i, NLINE, "some text");
+      for(s = line; *s; s++)
+        write(fd, s, 1);
+    }
+  }
+  fflush(fd);
+  i = nsyscall() - n0 - 2;  // less nsyscall's own getpid and getprocinfo
+  close(fd);
+  unlink("stdiofile");
+  return i;
+}
+
+int
+main(void)
+{
+  char buf[32];
+  int fd, n, bychar, unbuf, line, full;
+
+  // snprintf
+  n = snprintf(buf, sizeof(buf), "%d %x %s %c%%", -42, 0xbeef, "str", 'z');
+  if(n != 15 || strcmp(buf, "-42 BEEF str z%") != 0)
+    fail("snprintf formatted wrongly");
+  n = snprintf(buf, 5, "%s", "truncated");
+  if(n != 9 || strcmp(buf, "trun") != 0)
+    fail("snprintf did not cut output short");
+  buf[0] = 'x';
+  if(snprintf(buf, 0, "abc") != 3 || buf[0] != 'x')
+    fail("snprintf wrote to an empty buffer");
+
+  // System calls per printed line.
+  bychar = cost(0);
+  unbuf = cost(_IONBF);
+  line = cost(_IOLBF);
+  full = cost(_IOFBF);
+  printf(1, "syscalls per %d lines: %d per character, %d unbuffered, "
+         "%d line buffered, %d fully buffered\n",
+         NLINE, bychar, unbuf, line, full);
+  if(unbuf != 2*NLINE || line != NLINE || full >= NLINE/8 || full <= 0)
+    fail("printf made the wrong number of writes");
+
+  // Buffered output is written once, by the parent, across a fork.
+  fd = open("stdiofile", O_CREATE|O_RDWR);
+  printf(fd, "once");
+  if(fork() == 0)
+    exit();
+  wait();
+  close(fd);
+  fd = open("stdiofile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("stdiofile");
+  if(n != 4)
+    fail("buffered output was lost or written twice");
+
+  // printf and write to one descriptor come out in order.
+  fd = open("stdiofile", O_CREATE|O_RDWR);
+  printf(fd, "one ");
+  write(fd, "two ", 4);
+  printf(fd, "three");
+  close(fd);
+  fd = open("stdiofile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  unlink("stdiofile");
+  buf[n > 0 ? n : 0] = 0;
+  if(strcmp(buf, "one two three") != 0)
+    fail("printf and write came out of order");
+
+  if(passed){
+    printf(1, "Test Passed: printf buffered its output\n");
+  }
+
+  printf(1, "Test completed\n");
+  exit();
+}
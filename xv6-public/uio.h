@@ -0,0 +1,8 @@
+// Scatter/gather I/O, for readv and writev.
+
+#define IOV_MAX 16  // most segments in one call
+
+struct iovec {
+  void *iov_base;  // start of the segment
+  uint iov_len;    // bytes in it
+};
@@ -104,3 +104,180 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+//PAGEBREAK!
+// Buffered output. printf collects what it prints to each
+// descriptor below NSTDIO and writes it out a buffer at a time:
+// when a line ends for a device such as the console (_IOLBF),
+// when the buffer fills for files and pipes (_IOFBF), and at the
+// end of each printf for descriptor 2 (_IONBF). The wrappers at
+// the end flush buffers before the system calls that would
+// otherwise lose output, print it twice, or print it out of
+// order; see user.h.
+
+#define NSTDIO    16   // descriptors with output buffers
+#define STDIOBUF  512  // bytes of output buffer for each
+
+static struct {
+  char buf[STDIOBUF];
+  int n;       // bytes waiting in buf
+  int mode;    // _IOFBF, _IOLBF, _IONBF, or 0 if not decided yet
+} obuf[NSTDIO];
+
+static int
+outmode(int fd)
+{
+  struct stat st;
+
+  if(obuf[fd].mode == 0){
+    if(fd == 2)
+      obuf[fd].mode = _IONBF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEV)
+      obuf[fd].mode = _IOLBF;
+    else
+      obuf[fd].mode = _IOFBF;
+  }
+  return obuf[fd].mode;
+}
+
+// Write out what is waiting for fd, or for every descriptor
+// if fd is negative. Returns 0, or -1 if a write failed; the
+// output is dropped either way.
+int
+fflush(int fd)
+{
+  int n, r;
+
+  if(fd < 0){
+    r = 0;
+    for(fd = 0; fd < NSTDIO; fd++)
+      if(fflush(fd) < 0)
+        r = -1;
+    return r;
+  }
+  if(fd >= NSTDIO || obuf[fd].n == 0)
+    return 0;
+  n = obuf[fd].n;
+  obuf[fd].n = 0;
+  return _write(fd, obuf[fd].buf, n) == n ? 0 : -1;
+}
+
+// Choose how output to fd is buffered.
+int
+setvbuf(int fd, int mode)
+{
+  if(fd < 0 || fd >= NSTDIO ||
+     (mode != _IOFBF && mode != _IOLBF && mode != _IONBF))
+    return -1;
+  fflush(fd);
+  obuf[fd].mode = mode;
+  return 0;
+}
+
+// Write the n bytes at p to fd through its buffer.
+int
+bufwrite(int fd, const void *p, int n)
+{
+  const char *s;
+  int i, m, mode;
+
+  if(fd < 0 || fd >= NSTDIO)
+    return _write(fd, p, n);
+  mode = outmode(fd);
+  s = p;
+  for(i = 0; i < n; i += m){
+    if(obuf[fd].n == STDIOBUF && fflush(fd) < 0)
+      return -1;
+    m = STDIOBUF - obuf[fd].n;
+    if(m > n - i)
+      m = n - i;
+    memmove(obuf[fd].buf + obuf[fd].n, s + i, m);
+    obuf[fd].n += m;
+  }
+  if(mode == _IONBF)
+    return fflush(fd) < 0 ? -1 : n;
+  if(mode == _IOLBF){
+    for(i = 0; i < n; i++)
+      if(s[i] == '\n')
+        return fflush(fd) < 0 ? -1 : n;
+  }
+  return n;
+}
+
+int
+fork(void)
+{
+  fflush(-1);
+  return _fork();
+}
+
+int
+exit(void)
+{
+  fflush(-1);
+  _exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+  fflush(-1);
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  if(fd >= 0 && fd < NSTDIO){
+    fflush(fd);
+    obuf[fd].mode = 0;
+  }
+  return _close(fd);
+}
+
+// Flush line-buffered output, such as a prompt, before reading.
+static void
+flushlines(void)
+{
+  int fd;
+
+  for(fd = 0; fd < NSTDIO; fd++)
+    if(obuf[fd].mode == _IOLBF)
+      fflush(fd);
+}
+
+int
+read(int fd, void *p, int n)
+{
+  flushlines();
+  return _read(fd, p, n);
+}
+
+int
+readv(int fd, struct iovec *iov, int cnt)
+{
+  flushlines();
+  return _readv(fd, iov, cnt);
+}
+
+int
+write(int fd, const void *p, int n)
+{
+  fflush(fd);
+  return _write(fd, p, n);
+}
+
+int
+writev(int fd, struct iovec *iov, int cnt)
+{
+  fflush(fd);
+  return _writev(fd, iov, cnt);
+}
+
+int
+splice(int fdin, int fdout, int n)
+{
+  flushlines();
+  fflush(fdout);
+  return _splice(fdin, fdout, n);
+}
@@ -1,11 +1,15 @@
 struct stat;
 struct rtcdate;
+struct iostats;
+struct epoll_event;
+struct iovec;
 struct proc_info {
   int pid;
   int nice_value;
   int weight;
   double vruntime;
   int curr_runtime;
+  uint nsyscall;
 };
 struct rb_node_info {
   int pid;
@@ -17,15 +21,15 @@ struct rb_node_info {
 };
 
 // system calls
-int fork(void);
-int exit(void) __attribute__((noreturn));
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
 int wait(void);
 int pipe(int*);
-int write(int, const void*, int);
-int read(int, void*, int);
-int close(int);
+int _write(int, const void*, int);
+int _read(int, void*, int);
+int _close(int);
 int kill(int);
-int exec(char*, char**);
+int _exec(char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -42,14 +46,48 @@ int gettreeinfo(int *count, int *total_weight, int *period);
 int getprocinfo(int pid, struct proc_info *info);
 int gettreenodes(int max_nodes, struct rb_node_info *nodes);
 int treebalanced(void);
+int getprocinfo_many(int *pids, int n, struct proc_info *info);
+int iostat(struct iostats*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int _splice(int, int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, int);
+int epoll_wait(int, struct epoll_event*, int, int);
+int _readv(int, struct iovec*, int);
+int _writev(int, struct iovec*, int);
 
 // ulib.c
+// printf buffers its output; see bufwrite. The system calls
+// below flush it first: fork, exit and exec all of it, so that
+// none is lost or printed twice; write, writev, splice and close
+// a descriptor's own, so that printf's output and theirs come out
+// in order; and read and readv that of line-buffered descriptors,
+// so that a prompt printed without a newline shows before the
+// input is read. Other system calls do not, so call fflush
+// before, say, handing a descriptor to dup.
+#define _IOFBF 1  // write output when the buffer fills
+#define _IOLBF 2  // and when a line ends
+#define _IONBF 3  // and at the end of each printf
+int fork(void);
+int exit(void) __attribute__((noreturn));
+int exec(char*, char**);
+int close(int);
+int read(int, void*, int);
+int write(int, const void*, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int splice(int, int, int);
+int fflush(int);
+int setvbuf(int, int);
+int bufwrite(int, const void*, int);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void printf(int, const char*, ...);
+int snprintf(char*, int, const char*, ...);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
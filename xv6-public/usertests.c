@@ -184,6 +184,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// enough 512-byte writes to push a file past its inline extents
+// and first extent block, were each block its own extent
+#define BIGWRITES ((NEXTENT + NINDEXTENT + 1) * (BSIZE / 512))
+
 void
 writetest1(void)
 {
@@ -197,7 +201,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGWRITES; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +221,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGWRITES){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -1383,7 +1387,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<5000; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1395,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == 5000){
+    printf(1, "fork claimed to work 5000 times!\n");
     exit();
   }
 
@@ -32,7 +32,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
@@ -57,7 +57,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -79,13 +79,48 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages, but use 4Mbyte PTE_PS entries for every
+// 4Mbyte-aligned stretch of the range. Used for the kernel's
+// mappings so that most of them need no second-level page table.
+static int
+kmappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, last, n;
+
+  a = PGROUNDDOWN((uint)va);
+  last = PGROUNDDOWN((uint)va + size - 1);
+  for(;;){
+    if(a % HUGEPGSIZE == 0 && pa % HUGEPGSIZE == 0 &&
+       last - a >= HUGEPGSIZE - PGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      n = HUGEPGSIZE;
+    } else {
+      // Map 4Kbyte pages up to the next 4Mbyte boundary.
+      n = HUGEPGROUNDDOWN(a) + HUGEPGSIZE - a;
+      if(n > last - a + PGSIZE)
+        n = last - a + PGSIZE;
+      if(mappages(pgdir, (void*)a, n, pa, perm) < 0)
+        return -1;
+    }
+    if(a + n - PGSIZE == last)
+      break;
+    a += n;
+    pa += n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
-// setupkvm() and exec() set up every page table like this:
+// buildkvm() sets up kpgdir like this, and setupkvm() and exec()
+// set up every other page table the same way, sharing kpgdir's
+// kernel page tables:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
@@ -96,6 +131,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Everything from the first 4Mbyte boundary past data up to
+// PHYSTOP, and the device space, is mapped with 4Mbyte pages.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -114,9 +152,11 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
-pde_t*
-setupkvm(void)
+// Build the kernel part of a page table from kmap[].
+// This happens once, for kpgdir; every other page directory
+// shares kpgdir's kernel page tables (see setupkvm).
+static pde_t*
+buildkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
@@ -127,11 +167,25 @@ setupkvm(void)
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
+    if(kmappages(pgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm) < 0)
       return 0;
-    }
+  return pgdir;
+}
+
+// Set up kernel part of a page table by linking in
+// kpgdir's kernel page directory entries. The page tables
+// they point to are shared, so freevm() leaves them alone.
+pde_t*
+setupkvm(void)
+{
+  pde_t *pgdir;
+
+  if((pgdir = (pde_t*)kalloc()) == 0)
+    return 0;
+  memset(pgdir, 0, PGSIZE);
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -140,7 +194,8 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  if((kpgdir = buildkvm()) == 0)
+    panic("kvmalloc");
   switchkvm();
 }
 
@@ -203,9 +258,12 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
   if((uint) addr % PGSIZE != 0)
     panic("loaduvm: addr must be page aligned");
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
+    if(pgdir[PDX(addr+i)] & PTE_PS)
+      pa = HUGEPTE_ADDR(pgdir[PDX(addr+i)]) + (uint)(addr+i) % HUGEPGSIZE;
+    else if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
       panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
+    else
+      pa = PTE_ADDR(*pte);
     if(sz - i < PGSIZE)
       n = sz - i;
     else
@@ -218,19 +276,34 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Each 4Mbyte-aligned 4Mbyte stretch that the growth covers completely
+// gets a single 4Mbyte page while kallochuge() has some to hand out.
+// Memory stops at MMAPBASE; file mappings live above it.
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > MMAPBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Left mapped by a deallocuvm that could not split it.
+      a = HUGEPGROUNDDOWN(a) + HUGEPGSIZE - PGSIZE;
+      continue;
+    }
+    if(a % HUGEPGSIZE == 0 && newsz - a >= HUGEPGSIZE &&
+       (pgdir[PDX(a)] & PTE_P) == 0 && (mem = kallochuge()) != 0){
+      memset(mem, 0, HUGEPGSIZE);
+      pgdir[PDX(a)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+      a += HUGEPGSIZE - PGSIZE;
+      continue;
+    }
     mem = kalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
@@ -248,6 +321,28 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Replace the 4Mbyte page mapping va with a page table mapping
+// the same physical memory as 1024 ordinary 4Kbyte pages, which
+// from then on belong to kalloc()/kfree().
+static int
+splithuge(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  uint pa, flags;
+  int i;
+
+  pde = &pgdir[PDX(va)];
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = HUGEPTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -263,6 +358,21 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % HUGEPGSIZE == 0){
+        kfreehuge(P2V(HUGEPTE_ADDR(pgdir[PDX(a)])));
+        pgdir[PDX(a)] = 0;
+        a += HUGEPGSIZE - PGSIZE;
+        continue;
+      }
+      // Keeping part of a 4Mbyte page: turn it into 4Kbyte pages,
+      // freed one by one below. If that fails, leave it mapped
+      // until the process exits.
+      if(splithuge(pgdir, a) < 0){
+        a = HUGEPGROUNDDOWN(a) + HUGEPGSIZE - PGSIZE;
+        continue;
+      }
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -279,7 +389,8 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part's page tables belong
+// to kpgdir and are not freed.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +399,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -323,6 +434,26 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
+    if(pgdir[PDX(i)] & PTE_PS){
+      pa = HUGEPTE_ADDR(pgdir[PDX(i)]);
+      if((mem = kallochuge()) != 0){
+        memmove(mem, (char*)P2V(pa), HUGEPGSIZE);
+        d[PDX(i)] = V2P(mem) | PTE_FLAGS(pgdir[PDX(i)]);
+        i += HUGEPGSIZE - PGSIZE;
+        continue;
+      }
+      // No 4Mbyte page for the child: copy into 4Kbyte pages.
+      pa += i - HUGEPGROUNDDOWN(i);
+      flags = PTE_FLAGS(pgdir[PDX(i)]) & ~PTE_PS;
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+        kfree(mem);
+        goto bad;
+      }
+      continue;
+    }
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
     if(!(*pte & PTE_P))
@@ -345,16 +476,25 @@ bad:
 }
 
 //PAGEBREAK!
-// Map user virtual address to kernel address.
+// Map user virtual address to kernel address, for the kernel
+// to store into. The kernel's stores ignore PTE_W, so pages the
+// user may not write (read-only file mappings) are refused here.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
+  pde_t pde;
 
+  pde = pgdir[PDX(uva)];
+  if(pde & PTE_PS){
+    if((pde & (PTE_P|PTE_U|PTE_W)) != (PTE_P|PTE_U|PTE_W))
+      return 0;
+    return (char*)P2V(HUGEPTE_ADDR(pde)) + PGROUNDDOWN((uint)uva % HUGEPGSIZE);
+  }
   pte = walkpgdir(pgdir, uva, 0);
   if((*pte & PTE_P) == 0)
     return 0;
-  if((*pte & PTE_U) == 0)
+  if((*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
     return 0;
   return (char*)P2V(PTE_ADDR(*pte));
 }